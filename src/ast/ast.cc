@@ -1,6 +1,15 @@
 #include <sstream>
+#include <vector>
 
 #include "ast.hh"
+#include "variables.hh"
+
+long BaseAST::live_nodes = 0;
+
+BaseAST::BaseAST() : location("??"), expr_type(ValueType::NONE) {
+  live_nodes++;
+}
+BaseAST::~BaseAST() { live_nodes--; }
 
 void BaseAST::set_location(const std::string &loc) { this->location = loc; }
 
@@ -11,3 +20,22 @@ void BaseAST::set_location(const Decaf::location &loc) {
 }
 
 std::string BaseAST::to_string() { return ""; }
+
+void BaseAST::release(BaseAST *node) {
+  static std::vector<BaseAST *> pending;
+  static bool releasing = false;
+
+  if (node == nullptr)
+    return;
+  pending.push_back(node);
+  if (releasing)
+    return;
+
+  releasing = true;
+  while (!pending.empty()) {
+    BaseAST *next = pending.back();
+    pending.pop_back();
+    delete next;
+  }
+  releasing = false;
+}
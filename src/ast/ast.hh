@@ -5,10 +5,12 @@
 
 class ASTvisitor;
 
+enum class ValueType;
+
 class BaseAST {
 public:
-  BaseAST() : location("??") {}
-  virtual ~BaseAST() = default;
+  BaseAST();
+  virtual ~BaseAST();
 
   void set_location(const std::string &loc);
   void set_location(const Decaf::location &loc);
@@ -16,7 +18,18 @@ public:
   virtual void accept(ASTvisitor &V) = 0;
   virtual std::string to_string();
 
+  // delete `node`; children released by destructors while a release is in
+  // progress are queued, so deep trees don't recurse on the C++ stack
+  static void release(BaseAST *node);
+
+  // number of nodes currently allocated (for optimization statistics)
+  static long live_nodes;
+
   std::string location;
+
+  // type of the expression (computed in semantic analysis), NONE for
+  // statements and ill-typed expressions
+  ValueType expr_type;
 };
 
 // literals.hh
@@ -34,8 +47,6 @@ class ArrayAddressAST;
 class VariableDeclarationAST;
 class ArrayDeclarationAST;
 
-enum class ValueType;
-
 // operators.hh
 class UnaryOperatorAST;
 class BinaryOperatorAST;
@@ -63,6 +74,7 @@ class StatementBlockAST;
 class MethodDeclarationAST;
 class MethodCallAST;
 class CalloutCallAST;
+struct MethodEffects;
 
 // program.hh
 class ProgramAST;
\ No newline at end of file
@@ -3,10 +3,10 @@
 
 StatementBlockAST::~StatementBlockAST() {
   for (auto statement : statements) {
-    delete statement;
+    release(statement);
   }
   for (auto var : variable_declarations) {
-    delete var;
+    release(var);
   }
 }
 void StatementBlockAST::accept(ASTvisitor &V) { V.visit(*this); }
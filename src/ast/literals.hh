@@ -7,7 +7,7 @@
 
 class LiteralAST : public BaseAST {
 public:
-  LiteralAST(ValueType _type) : type(_type) {}
+  LiteralAST(ValueType _type) : type(_type) { expr_type = _type; }
   virtual ~LiteralAST() = default;
 
   virtual void accept(ASTvisitor &V);
@@ -2,9 +2,9 @@
 #include "../visitors/visitor.hh"
 
 MethodDeclarationAST::~MethodDeclarationAST() {
-  delete body;
+  release(body);
   for (auto param : parameters) {
-    delete param;
+    release(param);
   }
 }
 void MethodDeclarationAST::accept(ASTvisitor &V) { V.visit(*this); }
@@ -24,7 +24,7 @@ std::string MethodDeclarationAST::to_string() {
 
 MethodCallAST::~MethodCallAST() {
   for (auto arg : this->arguments) {
-    delete arg;
+    release(arg);
   }
 }
 void MethodCallAST::accept(ASTvisitor &V) { V.visit(*this); }
@@ -4,13 +4,36 @@
 #include "blocks.hh"
 #include "variables.hh"
 
+// What a call to a method may do, besides computing its result (including
+// what the methods it calls do; set by effect analysis). Everything until
+// then.
+struct MethodEffects {
+  MethodEffects()
+      : reads_globals(true), writes_globals(true), io(true), fails(true),
+        loops(true), recursive(true), unknown(true) {}
+
+  bool reads_globals, writes_globals;
+  // callouts to the I/O builtins
+  bool io;
+  // runtime errors (which print a message, then exit)
+  bool fails;
+  // loops that may not terminate (the body assigns to the iterator)
+  bool loops;
+  // calls itself (possibly through other methods)
+  bool recursive;
+  // anything: other callouts, or parallel loops (run by the thread pool)
+  bool unknown;
+};
+
 // Method declarations
 class MethodDeclarationAST : public BaseAST {
 public:
   MethodDeclarationAST(ValueType _rtype, const std::string &_name,
                        const std::vector<VariableDeclarationAST *> &_params,
                        StatementBlockAST *_body)
-      : name(_name), return_type(_rtype), parameters(_params), body(_body) {}
+      : name(_name), return_type(_rtype), parameters(_params), body(_body),
+        slot(-1), num_locals(0), call_count(0),
+        runs_in_parallel(false) {}
   virtual ~MethodDeclarationAST();
 
   virtual void accept(ASTvisitor &V);
@@ -20,19 +43,33 @@ public:
   ValueType return_type;
   std::vector<VariableDeclarationAST *> parameters;
   StatementBlockAST *body;
+
+  // set by semantic analysis: index among the methods, and number of local
+  // variable slots (parameters, block variables and loop iterators)
+  int slot;
+  int num_locals;
+  // number of call sites (set by semantic analysis)
+  int call_count;
+  MethodEffects effects;
+  // whether it may run on several threads at once: called from the body of
+  // a parallel loop, directly or not (set by effect analysis)
+  bool runs_in_parallel;
 };
 
 // Method calls
 class MethodCallAST : public BaseAST {
 public:
   MethodCallAST(std::string _id, std::vector<BaseAST *> args)
-      : id(_id), arguments(args) {}
+      : id(_id), arguments(args), decl(nullptr) {}
   virtual ~MethodCallAST();
 
   virtual void accept(ASTvisitor &V);
 
   std::string id;
   std::vector<BaseAST *> arguments;
+
+  // called method (set by semantic analysis), null for callouts
+  MethodDeclarationAST *decl;
 };
 
 class CalloutCallAST : public MethodCallAST {
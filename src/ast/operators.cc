@@ -41,12 +41,12 @@ std::string operator_type_to_string(const OperatorType &op) {
   return "";
 }
 
-UnaryOperatorAST::~UnaryOperatorAST() { delete val; }
+UnaryOperatorAST::~UnaryOperatorAST() { release(val); }
 void UnaryOperatorAST::accept(ASTvisitor &V) { V.visit(*this); }
 
 BinaryOperatorAST::~BinaryOperatorAST() {
-  delete lval;
-  delete rval;
+  release(lval);
+  release(rval);
 }
 void BinaryOperatorAST::accept(ASTvisitor &V) { V.visit(*this); }
 
@@ -3,10 +3,10 @@
 
 ProgramAST::~ProgramAST() {
   for (auto method : methods) {
-    delete method;
+    release(method);
   }
   for (auto var : global_variables) {
-    delete var;
+    release(var);
   }
 }
 void ProgramAST::accept(ASTvisitor &V) { V.visit(*this); }
@@ -1,27 +1,28 @@
 #include "statements.hh"
 #include "../visitors/visitor.hh"
 
-ReturnStatementAST::~ReturnStatementAST() { delete ret_expr; }
+ReturnStatementAST::~ReturnStatementAST() { release(ret_expr); }
 void ReturnStatementAST::accept(ASTvisitor &V) { V.visit(*this); }
 void BreakStatementAST::accept(ASTvisitor &V) { V.visit(*this); }
 void ContinueStatementAST::accept(ASTvisitor &V) { V.visit(*this); }
 
 IfStatementAST::~IfStatementAST() {
-  delete cond_expr;
-  delete then_block;
-  delete else_block;
+  release(cond_expr);
+  release(then_block);
+  release(else_block);
 }
 void IfStatementAST::accept(ASTvisitor &V) { V.visit(*this); }
 
 ForStatementAST::~ForStatementAST() {
-  delete start_expr;
-  delete end_expr;
-  delete block;
+  release(start_expr);
+  release(end_expr);
+  release(block);
+  release(iterator);
 }
 void ForStatementAST::accept(ASTvisitor &V) { V.visit(*this); }
 
 AssignStatementAST::~AssignStatementAST() {
-  delete lloc;
-  delete rval;
+  release(lloc);
+  release(rval);
 }
 void AssignStatementAST::accept(ASTvisitor &V) { V.visit(*this); }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "ast.hh"
 #include "operators.hh"
@@ -46,13 +47,33 @@ public:
 class ForStatementAST : public BaseAST {
 public:
   ForStatementAST(const std::string _id, BaseAST *st, BaseAST *en, BaseAST *b)
-      : iterator_id(_id), start_expr(st), end_expr(en), block(b) {}
+      : iterator_id(_id), start_expr(st), end_expr(en), block(b),
+        iterator(new VariableDeclarationAST(_id, ValueType::INT)),
+        tile_size(0), parallel(false) {}
   virtual ~ForStatementAST();
 
   virtual void accept(ASTvisitor &V);
 
   std::string iterator_id;
   BaseAST *start_expr, *end_expr, *block;
+
+  // declaration of the loop iterator, scoped to the loop
+  VariableDeclarationAST *iterator;
+
+  // accesses in the body whose bounds are checked once, before the loop
+  // (set by range analysis)
+  std::vector<ArrayLocationAST *> hoisted_checks;
+
+  // tile size, if this loop is in a tiled perfect nest (set by the loop nest
+  // optimizer), 0 otherwise
+  int tile_size;
+
+  // whether the iterations can run in parallel (`parallel for`, or set by
+  // dependence analysis): then the locals of the method that the body reads,
+  // and the scalars it only adds to (reductions; set by semantic analysis
+  // for `parallel for`)
+  bool parallel;
+  std::vector<VariableDeclarationAST *> captures, reductions;
 };
 
 class AssignStatementAST : public BaseAST {
@@ -19,7 +19,7 @@ std::string value_type_to_string(const ValueType &vt) {
   return "none";
 }
 
-LocationAST::~LocationAST() { delete index_expr; }
+LocationAST::~LocationAST() { release(index_expr); }
 void LocationAST::accept(ASTvisitor &V) { V.visit(*this); }
 
 void VariableLocationAST::accept(ASTvisitor &V) { V.visit(*this); }
@@ -22,7 +22,7 @@ std::string value_type_to_string(const ValueType &vt);
 class LocationAST : public BaseAST {
 public:
   LocationAST(std::string _id, BaseAST *_index, bool _is_lvalue)
-      : id(_id), index_expr(_index), is_lvalue(_is_lvalue) {}
+      : id(_id), index_expr(_index), is_lvalue(_is_lvalue), decl(nullptr) {}
   virtual ~LocationAST();
 
   virtual void accept(ASTvisitor &V);
@@ -30,6 +30,10 @@ public:
   std::string id;
   BaseAST *index_expr;
   bool is_lvalue;
+
+  // declaration `id` resolves to (set by semantic analysis), an
+  // ArrayDeclarationAST for array elements/addresses
+  VariableDeclarationAST *decl;
 };
 
 class VariableLocationAST : public LocationAST {
@@ -44,10 +48,13 @@ public:
 class ArrayLocationAST : public LocationAST {
 public:
   ArrayLocationAST(std::string id, BaseAST *index, bool is_lvalue = false)
-      : LocationAST(id, index, is_lvalue) {}
+      : LocationAST(id, index, is_lvalue), needs_bounds_check(true) {}
   virtual ~ArrayLocationAST() = default;
 
   virtual void accept(ASTvisitor &V);
+
+  // cleared when the index is proven to be in bounds
+  bool needs_bounds_check;
 };
 
 class ArrayAddressAST : public LocationAST {
@@ -65,8 +72,15 @@ public:
   std::string id;
   ValueType type;
 
+  // storage slot (set by semantic analysis): index among the globals, or
+  // among the locals (parameters included) of the enclosing method
+  bool is_global;
+  int slot;
+  // number of assignment statements to it (set by semantic analysis)
+  int assign_count;
+
   VariableDeclarationAST(std::string _id, ValueType _type = ValueType::NONE)
-      : id(_id), type(_type) {}
+      : id(_id), type(_type), is_global(false), slot(-1), assign_count(0) {}
   virtual ~VariableDeclarationAST() = default;
 
   virtual void accept(ASTvisitor &V);
@@ -1,41 +1,380 @@
-#include <iostream>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "parallel.hh"
+
+// Buffered I/O on the standard streams, with the semantics of
+// `std::cin >> val` / `std::cout << val`: a failed read (end of input, or
+// not a number) returns 0, and makes every later read fail as well.
+//
+// Output is written out when the buffer is full, before blocking on input
+// (so prompts are seen), at every newline if stdout is a terminal, and at
+// exit (including through runtime errors, which exit).
+
+namespace {
+
+class SpinLock {
+public:
+  void lock() {
+    while (flag.test_and_set(std::memory_order_acquire)) {
+    }
+  }
+  void unlock() { flag.clear(std::memory_order_release); }
+
+private:
+  std::atomic_flag flag = ATOMIC_FLAG_INIT;
+};
+SpinLock io_lock;
+
+class Output {
+public:
+  Output() : size(0), line_buffered(isatty(STDOUT_FILENO)) {}
+  ~Output() { flush(); }
+
+  void flush() {
+    for (unsigned done = 0; done < size;) {
+      ssize_t n = write(STDOUT_FILENO, buffer + done, size - done);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      done += n;
+    }
+    size = 0;
+  }
+
+  void put(char c) {
+    if (size == CAPACITY) {
+      flush();
+    }
+    buffer[size++] = c;
+    if (c == '\n' && line_buffered) {
+      flush();
+    }
+  }
+  void put(const char *str) {
+    while (*str) {
+      put(*str++);
+    }
+  }
+  void put_int(int val) {
+    // (digits in reverse, from the unsigned magnitude so INT_MIN works)
+    char digits[12];
+    int count = 0;
+    unsigned magnitude = val < 0 ? 0u - (unsigned)val : val;
+    do {
+      digits[count++] = '0' + magnitude % 10;
+      magnitude /= 10;
+    } while (magnitude > 0);
+    if (val < 0) {
+      digits[count++] = '-';
+    }
+    if (size + count > CAPACITY) {
+      flush();
+    }
+    while (count > 0) {
+      buffer[size++] = digits[--count];
+    }
+  }
+
+private:
+  static const unsigned CAPACITY = 1 << 16;
+  char buffer[CAPACITY];
+  unsigned size;
+  bool line_buffered;
+};
+Output output;
+
+class Input {
+public:
+  Input() : failed(false), pos(0), size(0) {}
+
+  // next character, without consuming it (EOF at the end of input)
+  int peek() {
+    if (pos == size && !refill())
+      return EOF;
+    return (unsigned char)buffer[pos];
+  }
+  void next() { pos++; }
+
+  // the whitespace skipped by operator>> (in the "C" locale)
+  static bool is_space(int c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' ||
+           c == '\r';
+  }
+  // skip whitespace, returns false at the end of input
+  bool skip_space() {
+    int c;
+    while (is_space(c = peek())) {
+      next();
+    }
+    return c != EOF;
+  }
+
+  // whether a read failed (all later reads fail too, like a stream with
+  // failbit set)
+  bool failed;
+
+  // read one integer (0 if the read fails)
+  int read_int() {
+    int val;
+    if (!failed && read_int_fast(val))
+      return val;
+    return read_int_slow();
+  }
+  // read one (non-whitespace) character (0 if the read fails)
+  int read_char() {
+    if (failed || !skip_space()) {
+      failed = true;
+      return 0;
+    }
+    char val = peek();
+    next();
+    return val;
+  }
+
+private:
+  int read_int_slow() {
+    if (failed || !skip_space()) {
+      failed = true;
+      return 0;
+    }
+
+    bool negative = false;
+    int c = peek();
+    if (c == '-' || c == '+') {
+      negative = c == '-';
+      next();
+    }
+
+    // (accumulated as unsigned; out of range values saturate, and fail)
+    unsigned long long magnitude = 0;
+    bool digits = false, overflow = false;
+    while ((c = peek()) >= '0' && c <= '9') {
+      next();
+      digits = true;
+      magnitude = magnitude * 10 + (c - '0');
+      if (magnitude > (unsigned long long)INT_MAX + 1) {
+        overflow = true;
+        magnitude = (unsigned long long)INT_MAX + 1;
+      }
+    }
+
+    if (!digits) {
+      failed = true;
+      return 0;
+    }
+    if (overflow || (!negative && magnitude > INT_MAX)) {
+      failed = true;
+      return negative ? INT_MIN : INT_MAX;
+    }
+    return negative ? (int)(0u - (unsigned)magnitude) : (int)magnitude;
+  }
+
+  // Fast path, for a well-formed int of at most 10 digits in the middle of
+  // the buffer (anything else is left to read_int_slow, nothing consumed):
+  // the digits are found 16 bytes at a time (SSE2), and converted 8 at a
+  // time in a 64 bit word (SWAR).
+  bool read_int_fast(int &val) {
+    const char *p = buffer + pos, *end = buffer + size;
+    if (end - p < 32)
+      return false;
+    while (is_space(*p) && end - p > 16) {
+      p++;
+    }
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+') {
+      p++;
+    }
+    if (end - p < 16)
+      return false;
+
+    unsigned length = digit_count(p);
+    if (length == 0 || length > 10)
+      return false;
+
+    uint64_t word;
+    memcpy(&word, p, 8);
+    uint64_t magnitude;
+    if (length <= 8) {
+      // (the digits moved to the top bytes, zeros below them)
+      magnitude = convert_eight((word - 0x3030303030303030ULL)
+                                << (8 * (8 - length)));
+    } else {
+      magnitude = convert_eight(word - 0x3030303030303030ULL);
+      for (unsigned i = 8; i < length; i++) {
+        magnitude = magnitude * 10 + (p[i] - '0');
+      }
+      if (magnitude > (uint64_t)INT_MAX + negative)
+        return false;
+    }
+
+    val = negative ? (int)(0u - (unsigned)magnitude) : (int)magnitude;
+    pos = p + length - buffer;
+    return true;
+  }
+
+  // number of leading digits in the 16 bytes at p (16 if all are)
+  static unsigned digit_count(const char *p) {
+#ifdef __SSE2__
+    __m128i chars = _mm_loadu_si128((const __m128i *)p);
+    __m128i digits =
+        _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)),
+                      _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+    unsigned mask = _mm_movemask_epi8(digits);
+    return __builtin_ctz(~mask); // (bit 16 of ~mask is set)
+#else
+    unsigned count = 0;
+    while (count < 16 && p[count] >= '0' && p[count] <= '9') {
+      count++;
+    }
+    return count;
+#endif
+  }
+
+  // the value of 8 decimal digits (0-9, first digit in the lowest byte)
+  static uint64_t convert_eight(uint64_t digits) {
+    // pairs of digits, then groups of 4, then all 8
+    digits = (digits * 10 + (digits >> 8)) & 0x00FF00FF00FF00FFULL;
+    digits = (digits * 100 + (digits >> 16)) & 0x0000FFFF0000FFFFULL;
+    return (digits * 10000 + (digits >> 32)) & 0xFFFFFFFFULL;
+  }
+
+  bool refill() {
+    output.flush();
+    ssize_t n;
+    do {
+      n = read(STDIN_FILENO, buffer, CAPACITY);
+    } while (n < 0 && errno == EINTR);
+    pos = 0;
+    size = n > 0 ? n : 0;
+    return size > 0;
+  }
+
+  static const unsigned CAPACITY = 1 << 16;
+  char buffer[CAPACITY];
+  unsigned pos, size;
+};
+Input input;
+
+// (parallel loops may do I/O from several threads: only locked then)
+class Guard {
+public:
+  Guard() : locked(decaf_parallel_running.load(std::memory_order_relaxed)) {
+    if (locked) {
+      io_lock.lock();
+    }
+  }
+  ~Guard() {
+    if (locked) {
+      io_lock.unlock();
+    }
+  }
+
+private:
+  bool locked;
+};
+
+} // namespace
 
 extern "C" {
 // read_int: reads one integer from stdin
 int read_int() {
-  int val;
-  std::cin >> val;
-  return val;
+  Guard guard;
+  return input.read_int();
 }
 
-// read_char: reads one character from stdin
+// read_char: reads one (non-whitespace) character from stdin
 int read_char() {
-  char val;
-  std::cin >> val;
-  return val;
+  Guard guard;
+  return input.read_char();
+}
+
+// read_int_array: reads n integers from stdin into arr[0..n), returns the
+// number read before a read failed (the rest are set to 0, as by read_int)
+int read_int_array(int *arr, int n) {
+  Guard guard;
+  int count = 0;
+  for (int i = 0; i < n; i++) {
+    arr[i] = input.read_int();
+    count += !input.failed;
+  }
+  return count;
 }
 
 // write_int: prints one integer to stdout
 int write_int(int val) {
-  std::cout << val;
+  Guard guard;
+  output.put_int(val);
+  return 0;
+}
+
+// write_int_array: prints arr[0..n) to stdout, each followed by sep
+int write_int_array(const int *arr, int n, int sep) {
+  Guard guard;
+  for (int i = 0; i < n; i++) {
+    output.put_int(arr[i]);
+    output.put((char)sep);
+  }
   return 0;
 }
 
 // write_bool: prints one boolean value to stdout
 int write_bool(bool val) {
-  std::cout << std::boolalpha << val << std::noboolalpha;
+  Guard guard;
+  output.put(val ? "true" : "false");
   return 0;
 }
 
 // write_char: prints one character to stdout
-int write_char(char val) {
-  std::cout << val;
+int write_char(int val) {
+  Guard guard;
+  output.put((char)val);
   return 0;
 }
 
 // write_string: prints a string literal to stdout
 int write_string(const char *val) {
-  std::cout << val;
+  Guard guard;
+  output.put(val);
   return 0;
 }
+
+// decaf_runtime_error: prints "Runtime error: <message><name> [<location>]"
+// and exits with `code` (the errors of the generated code). In a parallel
+// loop, only the first error is reported (threads failing after it wait for
+// the exit), and the process exits at once with _exit: the other threads
+// may still be running the loop, using what exit's destructors tear down.
+[[noreturn]] void decaf_runtime_error(const char *message, const char *name,
+                                      const char *location, int code) {
+  static std::atomic_flag reported = ATOMIC_FLAG_INIT;
+  if (reported.test_and_set()) {
+    for (;;) {
+      pause();
+    }
+  }
+
+  Guard guard;
+  output.put("Runtime error: ");
+  output.put(message);
+  output.put(name);
+  output.put(" [");
+  output.put(location);
+  output.put("]\n");
+  if (!decaf_parallel_running.load(std::memory_order_relaxed)) {
+    exit(code);
+  }
+  output.flush();
+  _exit(code);
+}
 }
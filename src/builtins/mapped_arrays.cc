@@ -0,0 +1,67 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// File-backed global arrays (see --map in the compiler): the file holds the
+// elements as raw ints (native byte order), and is mapped lazily (pages are
+// read on first access).
+
+extern "C" int write_string(const char *val);
+
+namespace {
+
+// Runtime error: <message> (exits, as the errors of the generated code do)
+void map_error(const char *name, const char *path, const char *reason) {
+  static const int SIZE = 300;
+  char message[SIZE];
+  snprintf(message, SIZE, "Runtime error: Cannot map array %s from `%s`: %s\n",
+           name, path, reason);
+  write_string(message);
+  exit(3);
+}
+
+} // namespace
+
+extern "C" {
+// decaf_map_array: maps `path` as the `length` ints of array `name`,
+// copy-on-write if `writable` (changes stay private to the process), else
+// read-only; exits with an error if the file can't be mapped, or doesn't
+// hold exactly `length` ints
+int *decaf_map_array(const char *name, const char *path, int length,
+                     int writable) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    map_error(name, path, strerror(errno));
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    map_error(name, path, strerror(errno));
+  }
+  long long expected = (long long)length * sizeof(int);
+  if (info.st_size != expected) {
+    char reason[100];
+    snprintf(reason, sizeof(reason),
+             "file has %lld bytes, expected %lld (%d ints)",
+             (long long)info.st_size, expected, length);
+    map_error(name, path, reason);
+  }
+
+  // (no swap reserved for private copies: only the pages written need any)
+  int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+  int flags = writable ? MAP_PRIVATE | MAP_NORESERVE : MAP_PRIVATE;
+  void *data = mmap(nullptr, expected, protection, flags, fd, 0);
+  if (data == MAP_FAILED) {
+    map_error(name, path, strerror(errno));
+  }
+  close(fd);
+
+  return (int *)data;
+}
+}
@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "parallel.hh"
+
+// Thread pool running parallel for loops (see CodeGenerator).
+//
+// A loop is split into one range per thread; each thread runs its ranges,
+// splitting off halves while they are larger than the grain (pushed on its
+// own queue), and once out of work steals ranges from the other queues.
+
+namespace {
+
+typedef void (*LoopBody)(void *env, int start, int end);
+
+struct Range {
+  long long start, end;
+};
+
+// ranges of a thread: it takes from the back, others steal from the front
+class WorkQueue {
+public:
+  void push(Range range) {
+    std::lock_guard<std::mutex> guard(lock);
+    ranges.push_back(range);
+  }
+  bool pop(Range &range) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (ranges.empty())
+      return false;
+    range = ranges.back();
+    ranges.pop_back();
+    return true;
+  }
+  bool steal(Range &range) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (ranges.empty())
+      return false;
+    range = ranges.front();
+    ranges.pop_front();
+    return true;
+  }
+
+private:
+  std::mutex lock;
+  std::deque<Range> ranges;
+};
+
+class ThreadPool {
+public:
+  ThreadPool(unsigned threads) : queues(threads), generation(0), busy(0) {
+    // (thread 0 is the one running the program)
+    for (unsigned id = 1; id < threads; id++) {
+      std::thread(&ThreadPool::worker, this, id).detach();
+    }
+  }
+
+  unsigned size() { return queues.size(); }
+
+  void run(LoopBody _body, void *_env, long long start, long long end,
+           long long _grain) {
+    body = _body;
+    env = _env;
+    grain = _grain;
+    remaining.store(end - start, std::memory_order_release);
+    long long chunk = (end - start + size() - 1) / size();
+    for (unsigned id = 0; id < size() && start < end; id++) {
+      queues[id].push({start, std::min(start + chunk, end)});
+      start += chunk;
+    }
+
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      generation++;
+      busy = size() - 1;
+    }
+    started.notify_all();
+
+    work(0);
+
+    // (the workers may still be looking for ranges to steal)
+    std::unique_lock<std::mutex> guard(lock);
+    finished.wait(guard, [this] { return busy == 0; });
+  }
+
+private:
+  std::vector<WorkQueue> queues;
+  // the current loop
+  LoopBody body;
+  void *env;
+  long long grain;
+  // iterations not run yet
+  std::atomic<long long> remaining;
+
+  // loops started, and workers still running the current one
+  std::mutex lock;
+  std::condition_variable started, finished;
+  unsigned long long generation;
+  unsigned busy;
+
+  void worker(unsigned id) {
+    unsigned long long seen = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        started.wait(guard, [&] { return generation != seen; });
+        seen = generation;
+      }
+
+      work(id);
+
+      std::lock_guard<std::mutex> guard(lock);
+      if (--busy == 0) {
+        finished.notify_one();
+      }
+    }
+  }
+
+  // run ranges of the current loop until all of them are done
+  void work(unsigned id) {
+    while (remaining.load(std::memory_order_acquire) > 0) {
+      Range range;
+      if (!queues[id].pop(range) && !steal(id, range)) {
+        std::this_thread::yield();
+        continue;
+      }
+      // (leaving the rest to other threads)
+      while (range.end - range.start > grain) {
+        long long middle = range.start + (range.end - range.start) / 2;
+        queues[id].push({middle, range.end});
+        range.end = middle;
+      }
+      body(env, range.start, range.end);
+      remaining.fetch_sub(range.end - range.start, std::memory_order_acq_rel);
+    }
+  }
+
+  bool steal(unsigned id, Range &range) {
+    for (unsigned i = 1; i < size(); i++) {
+      if (queues[(id + i) % size()].steal(range))
+        return true;
+    }
+    return false;
+  }
+};
+
+} // namespace
+
+// (loops started by the body of a running one run serially)
+std::atomic<bool> decaf_parallel_running(false);
+
+extern "C" {
+// decaf_parallel_for: runs body(env, s, e) over chunks [s, e) covering
+// [start, end), on `threads` threads (0: one per core); on this thread if
+// there are fewer than 2 * grain iterations
+void decaf_parallel_for(LoopBody body, void *env, int start, int end,
+                        int threads, int grain) {
+  // (created on first use, and never destroyed: threads may still be waiting
+  // for work when the program exits)
+  static ThreadPool *pool = new ThreadPool(
+      threads > 0 ? threads
+                  : std::max(1u, std::thread::hardware_concurrency()));
+
+  long long count = (long long)end - start;
+  if (count <= 0)
+    return;
+  if (pool->size() == 1 || count < 2LL * grain ||
+      decaf_parallel_running.exchange(true)) {
+    body(env, start, end);
+    return;
+  }
+
+  pool->run(body, env, start, end, grain);
+  decaf_parallel_running.store(false);
+}
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <atomic>
+
+// whether decaf_parallel_for is running a loop on the thread pool (the
+// program is single threaded otherwise)
+extern std::atomic<bool> decaf_parallel_running;
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../ast/variables.hh"
+
+// Signatures of the callouts implemented by the runtime (io.cc), all
+// returning int: calls are checked against them in semantic analysis, and
+// declared with exact prototypes and attributes in code generation.
+struct BuiltinSignature {
+  // as typed in Decaf (chars are ints)
+  std::vector<ValueType> params;
+  // the memory it accesses besides the runtime's own state (buffers), which
+  // the program can't see: none, or the arrays/strings passed to it, either
+  // read or written
+  enum class Memory { NONE, READS_ARGUMENTS, WRITES_ARGUMENTS } memory;
+  // whether it writes output (the others only read input)
+  bool writes_output;
+};
+
+// signature of the builtin `name`, nullptr if there is none
+inline const BuiltinSignature *find_builtin(const std::string &name) {
+  typedef BuiltinSignature::Memory Memory;
+  static const std::map<std::string, BuiltinSignature> builtins = {
+      {"read_int", {{}, Memory::NONE, false}},
+      {"read_char", {{}, Memory::NONE, false}},
+      {"read_int_array",
+       {{ValueType::INT_ARRAY, ValueType::INT}, Memory::WRITES_ARGUMENTS,
+        false}},
+      {"write_int", {{ValueType::INT}, Memory::NONE, true}},
+      {"write_bool", {{ValueType::BOOL}, Memory::NONE, true}},
+      {"write_char", {{ValueType::INT}, Memory::NONE, true}},
+      {"write_string", {{ValueType::STRING}, Memory::READS_ARGUMENTS, true}},
+      {"write_int_array",
+       {{ValueType::INT_ARRAY, ValueType::INT, ValueType::INT},
+        Memory::READS_ARGUMENTS, true}},
+  };
+
+  auto it = builtins.find(name);
+  return it == builtins.end() ? nullptr : &it->second;
+}
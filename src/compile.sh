@@ -5,6 +5,7 @@
 
 # @arg $1 : path/to/code.dcf
 # @arg $2 opt : path/to/executable, defaults to ./a.out
+# @env DECAF_FLAGS : extra options for decaf (eg. --bounds=hoisted)
 
 if [[ "$#" -lt 1 ]] ; then
 	echo "Usage: bin/compile <path/to/code.dcf> [clang-opts]"
@@ -12,7 +13,13 @@ if [[ "$#" -lt 1 ]] ; then
 fi
 
 code=$1
-./bin/decaf $code --output=bin/.temp.ll
+./bin/decaf $code --output=bin/.temp.ll $DECAF_FLAGS
+
+# (the runtime is already linked into the IR with --runtime)
+builtins=build/builtins.o
+if [[ "$DECAF_FLAGS" == *--runtime=* ]] ; then
+	builtins=
+fi
 
 shift
-clang++ $@ -Wno-override-module build/builtins.o bin/.temp.ll
+clang++ $@ -pthread -Wno-override-module $builtins bin/.temp.ll
@@ -46,6 +46,12 @@
 	#include "visitors/visitor.hh"
 	#include "visitors/treegen.hh"
 	#include "visitors/semantic_analyzer.hh"
+	#include "visitors/constant_folder.hh"
+	#include "visitors/loop_nest_optimizer.hh"
+	#include "visitors/dependence_analyzer.hh"
+	#include "visitors/range_analyzer.hh"
+	#include "visitors/effect_analyzer.hh"
+	#include "visitors/type_verifier.hh"
 	#include "visitors/codegen.hh"
 
 	#undef yylex
@@ -81,7 +87,7 @@
 %token END 0
 
  /* keywords */
-%token CLASS IF ELSE FOR BREAK CONTINUE RETURN CALLOUT
+%token CLASS IF ELSE FOR PARALLEL BREAK CONTINUE RETURN CALLOUT
 %token INT BOOL VOID
 
  /* literals */
@@ -149,7 +155,7 @@ type : INT { $$ = ValueType::INT; }
 
 field_decl_list : field_decl_list field_decl {
 												$$ = $1;
-												$$->insert($$->end(), $2->rbegin(), $2->rend());
+												$$->insert($$->end(), $2->begin(), $2->end());
 												delete $2;
 											}
 		  		| %empty {
@@ -168,9 +174,9 @@ glob_var_decl_list : glob_var_decl {
 										$$ = new std::vector<VariableDeclarationAST *>();
 										$$->push_back($1); 
 								}
-				   | glob_var_decl ',' glob_var_decl_list {
-				   											  $$ = $3;
-				   											  $$->push_back($1);
+				   | glob_var_decl_list ',' glob_var_decl {
+				   											  $$ = $1;
+				   											  $$->push_back($3);
 														}
 				   ;
 glob_var_decl : ID { 
@@ -194,13 +200,11 @@ method_decl_list : method_decl_list method_decl {
 				 				}
 				 ;
 method_decl : type ID '(' param_list ')' block {
-													std::reverse($4->begin(), $4->end());
 													$$ = new MethodDeclarationAST($1, $2, *$4, $6);
 													$$->set_location(@2);
 													delete $4;
 											}
 			| VOID ID '(' param_list ')' block {
-													std::reverse($4->begin(), $4->end());
 													$$ = new MethodDeclarationAST(ValueType::VOID, $2, *$4, $6);
 													$$->set_location(@2);
 													delete $4;
@@ -214,9 +218,9 @@ param_list_non_empty : param {
 								$$ = new std::vector<VariableDeclarationAST *>();
 								$$->push_back($1);
 							 }
-		   			 | param ',' param_list_non_empty { 
-		   			 									$$ = $3; 
-		   			 									$$->push_back($1);
+		   			 | param_list_non_empty ',' param { 
+		   			 									$$ = $1; 
+		   			 									$$->push_back($3);
 		   			 								}
 		   			 ;
 param : type ID { $$ = new VariableDeclarationAST(std::string($2), $1); $$->set_location(@$); }
@@ -233,7 +237,7 @@ block : '{' var_decl_list statement_list '}' {
 
 var_decl_list : var_decl_list var_decl { 
 											$$ = $1;
-											$$->insert($$->end(), $2->rbegin(), $2->rend());
+											$$->insert($$->end(), $2->begin(), $2->end());
 											delete $2;
 										}
 			  | %empty { $$ = new std::vector<VariableDeclarationAST *>(); }
@@ -250,10 +254,10 @@ var_list : ID {
 				$$->push_back(new VariableDeclarationAST($1, ValueType::NONE)); 
 				$$->back()->set_location(@$);
 			  }
-		 | ID ',' var_list  {
-								$$ = $3;
-								$$->push_back(new VariableDeclarationAST($1, ValueType::NONE));
-								$$->back()->set_location(@$);
+		 | var_list ',' ID  {
+								$$ = $1;
+								$$->push_back(new VariableDeclarationAST($3, ValueType::NONE));
+								$$->back()->set_location(@3);
 							}
 		 ;
 
@@ -267,7 +271,19 @@ statement_list : statement_list statement    {
 statement : location assign_op expr ';' { $1->is_lvalue = true; $$ = new AssignStatementAST($2, $1, $3); $$->set_location(@$); }
 		  | method_call ';' { $$ = $1; }
 		  | IF '(' expr ')' block else_block { $$ = new IfStatementAST($3, $5, $6); $$->set_location(@$); }
-		  | FOR ID ASSIGN expr ',' expr block { $$ = new ForStatementAST($2, $4, $6, $7); $$->set_location(@$); }
+		  | FOR ID ASSIGN expr ',' expr block {
+		  										auto loop = new ForStatementAST($2, $4, $6, $7);
+		  										loop->iterator->set_location(@2);
+		  										$$ = loop;
+		  										$$->set_location(@$);
+		  									}
+		  | PARALLEL FOR ID ASSIGN expr ',' expr block {
+		  										auto loop = new ForStatementAST($3, $5, $7, $8);
+		  										loop->iterator->set_location(@3);
+		  										loop->parallel = true;
+		  										$$ = loop;
+		  										$$->set_location(@$);
+		  									}
 		  | BREAK ';' { $$ = new BreakStatementAST(); $$->set_location(@$); }
 		  | CONTINUE ';' { $$ = new ContinueStatementAST(); $$->set_location(@$); }
 		  | RETURN expr ';' { $$ = new ReturnStatementAST($2); $$->set_location(@$); }
@@ -317,20 +333,18 @@ location : ID { std::string id($1); $$ = new VariableLocationAST(id); $$->set_lo
 		 
 /* method calls */
 method_call : ID '(' args ')' { 
-								std::reverse($3->begin(), $3->end());
 								$$ = new MethodCallAST(std::string($1), *$3);
 								$$->set_location(@$); 
 								delete $3; 
 							}
 			| CALLOUT '(' STRING_LIT callout_arg_list ')' { 
-															std::reverse($4->begin(), $4->end());
 															$$ = new CalloutCallAST(std::string($3), *$4); 
 															$$->set_location(@$); 
 															delete $4;
 														}
 			;
 
-callout_arg_list : ',' callout_arg callout_arg_list { ($$ = $3)->push_back($2); }
+callout_arg_list : callout_arg_list ',' callout_arg { ($$ = $1)->push_back($3); }
 				 | %empty { $$ = new std::vector<BaseAST *>(); }
 				 ;
 callout_arg : arg { $$ = $1; }
@@ -348,7 +362,7 @@ arg_list : arg 	{
 					$$ = new std::vector<BaseAST *>();
 					$$->push_back($1);
 				}
-		 | arg ',' arg_list { ($$ = $3)->push_back($1); }
+		 | arg_list ',' arg { ($$ = $1)->push_back($3); }
 		 ;
 arg: expr { $$ = $1; }
    ;
@@ -361,7 +375,17 @@ literal : INT_LIT { $$ = new IntegerLiteralAST($1); $$->set_location(@$); }
 %%
 
 void show_help(bool quit = true) {
-	std::cerr << "Usage: decaf <file>.dcf [--output=<output-file>]\n";
+	std::cerr << "Usage: decaf <file>.dcf [--output=<output-file>] [--stats]\n"
+	          << "                        [--bounds=full|hoisted|off] [--mem2reg]\n"
+	          << "                        [--target-cpu=native|<cpu>]\n"
+	          << "                        [--target-features=native|<+f,-g...>]\n"
+	          << "                        [--vectorize] [--pack-bools]\n"
+	          << "                        [--interchange] [--tile=<size>]\n"
+	          << "                        [--parallel[=<threads>]]\n"
+	          << "                        [--map=<array>=<file>]"
+	          << " [--map-ro=<array>=<file>]\n"
+	          << "                        [--runtime=<builtins.bc>]"
+	          << " [--check-types]\n";
 	if (quit) exit(1);
 }
 
@@ -375,12 +399,63 @@ int main(int argc, char **argv) {
 		show_help();
 
 	std::string out_filename = "";
-	if (argc >= 3) {
-		out_filename = std::string(argv[2]);
-		if (out_filename.size() < 9 || out_filename.substr(0, 9) != "--output=") {
+	bool show_stats = false;
+	bool check_types = false;
+	bool interchange = false;
+	bool parallel = false;
+	int tile_size = 0;
+	CodeGenerator::Options options;
+	for (int i = 2; i < argc; i++) {
+		std::string arg(argv[i]);
+		if (arg.substr(0, 9) == "--output=") {
+			out_filename = arg.substr(9);
+		} else if (arg == "--stats") {
+			show_stats = true;
+		} else if (arg == "--check-types") {
+			check_types = true;
+		} else if (arg == "--bounds=full") {
+			options.bounds = CodeGenerator::Options::BoundsChecks::FULL;
+		} else if (arg == "--bounds=hoisted") {
+			options.bounds = CodeGenerator::Options::BoundsChecks::HOISTED;
+		} else if (arg == "--bounds=off") {
+			options.bounds = CodeGenerator::Options::BoundsChecks::OFF;
+		} else if (arg == "--mem2reg") {
+			options.promote_locals = true;
+		} else if (arg == "--interchange") {
+			interchange = true;
+		} else if (arg.substr(0, 7) == "--tile=") {
+			tile_size = atoi(arg.substr(7).c_str());
+			if (tile_size < 2) show_help();
+		} else if (arg == "--parallel") {
+			parallel = true;
+		} else if (arg.substr(0, 11) == "--parallel=") {
+			parallel = true;
+			int threads = atoi(arg.substr(11).c_str());
+			if (threads < 1) show_help();
+			options.threads = threads;
+		} else if (arg.substr(0, 6) == "--map=" || arg.substr(0, 9) == "--map-ro=") {
+			// <array>=<file>
+			bool writable = arg.substr(0, 6) == "--map=";
+			std::string mapping = arg.substr(writable ? 6 : 9);
+			size_t split = mapping.find('=');
+			if (split == std::string::npos || split == 0
+				|| split + 1 == mapping.size())
+				show_help();
+			options.mapped_arrays[mapping.substr(0, split)] = {
+				mapping.substr(split + 1), writable};
+		} else if (arg.substr(0, 10) == "--runtime=") {
+			options.runtime = arg.substr(10);
+		} else if (arg == "--pack-bools") {
+			options.pack_bools = true;
+		} else if (arg == "--vectorize") {
+			options.vectorize = true;
+		} else if (arg.substr(0, 13) == "--target-cpu=") {
+			options.target_cpu = arg.substr(13);
+		} else if (arg.substr(0, 18) == "--target-features=") {
+			options.target_features = arg.substr(18);
+		} else {
 			show_help();
 		}
-		out_filename = out_filename.substr(9, out_filename.size() - 9);
 	}
 
 	std::ifstream fin(filename);
@@ -419,16 +494,61 @@ int main(int argc, char **argv) {
 #endif
 		return 1;
 	}
+	// (warnings)
+	analyzer->display(std::cerr);
 
 	delete analyzer;
 
+	// AST optimizations
+	ConstantFolder *folder = new ConstantFolder();
+	folder->optimize(*(driver.root));
+	if (show_stats) folder->display_stats(std::cerr);
+	delete folder;
+
+	if (interchange || tile_size > 0) {
+		LoopNestOptimizer *loops = new LoopNestOptimizer(interchange, tile_size);
+		loops->optimize(*(driver.root));
+		if (show_stats) loops->display_stats(std::cerr);
+		delete loops;
+	}
+
+	if (parallel) {
+		DependenceAnalyzer *dependences = new DependenceAnalyzer();
+		dependences->analyze(*(driver.root));
+		if (show_stats) dependences->display_stats(std::cerr);
+		delete dependences;
+	}
+
+	RangeAnalyzer *ranges = new RangeAnalyzer(
+		options.bounds == CodeGenerator::Options::BoundsChecks::HOISTED);
+	ranges->analyze(*(driver.root));
+	if (show_stats) ranges->display_stats(std::cerr);
+	delete ranges;
+
+	EffectAnalyzer *effects = new EffectAnalyzer(
+		options.bounds != CodeGenerator::Options::BoundsChecks::OFF);
+	effects->analyze(*(driver.root));
+	if (show_stats) effects->display_stats(std::cerr);
+	delete effects;
+
+	// (after all the AST passes, which may add expressions)
+	if (check_types) {
+		TypeVerifier *types = new TypeVerifier();
+		bool typed = types->verify(*(driver.root));
+		types->display(std::cerr);
+		delete types;
+		if (!typed) return 1;
+	}
+
 	// code generation (LLVM IR)
-	CodeGenerator *IR_gen = new CodeGenerator(filename);
-	IR_gen->generate(*(driver.root));	
+	CodeGenerator *IR_gen = new CodeGenerator(filename, options);
+	if (!IR_gen->generate(*(driver.root))) {
+		return 1;
+	}
 	IR_gen->print(out_filename);
 
 	// cleanup
-	delete driver.root;
+	BaseAST::release(driver.root);
 	delete driver.parser;
 	delete driver.scanner;
 
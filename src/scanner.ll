@@ -96,6 +96,7 @@ void beautify_string(char *s) {
 "if"					{return token::IF;}
 "else"					{return token::ELSE;}
 "for"					{return token::FOR;}
+"parallel"				{return token::PARALLEL;}
 "break"					{return token::BREAK;}
 "continue"				{return token::CONTINUE;}
 "return"				{return token::RETURN;}
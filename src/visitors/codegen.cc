@@ -1,9 +1,24 @@
+#include <algorithm>
+#include <cmath>
 #include <cstdarg>
 #include <cstring>
 #include <iostream>
+#include <memory>
 
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/IPO/Internalize.h>
+#include <llvm/Transforms/Utils/PromoteMemToReg.h>
 
 #include "../ast/ast.hh"
 #include "../ast/blocks.hh"
@@ -13,70 +28,274 @@
 #include "../ast/program.hh"
 #include "../ast/statements.hh"
 #include "../ast/variables.hh"
+#include "../builtins/signatures.hh"
 #include "../exceptions.hh"
 #include "codegen.hh"
 
-/*** CodeGenerator::SymbolTable ***/
-void CodeGenerator::SymbolTable::block_start() { variables.emplace_back(); }
-void CodeGenerator::SymbolTable::block_end() {
-  assert(!variables.empty());
-  variables.pop_back();
+/*** CodeGenerator ***/
+CodeGenerator::CodeGenerator(std::string name, Options _options)
+    : builder(context), options(_options) {
+  module = new llvm::Module(name, context);
+  has_error = false;
+  num_loops = num_calls = num_unbounded_loops = 0;
+  packed_bit = nullptr;
+  in_parallel_body = false;
+  set_target();
 }
+CodeGenerator::~CodeGenerator() { delete module; }
 
-void CodeGenerator::SymbolTable::add_variable(std::string id,
-                                              llvm::AllocaInst *alloca) {
-  variables.back()[id] = alloca;
-}
-llvm::AllocaInst *CodeGenerator::SymbolTable::lookup_variable(std::string id) {
-  for (auto it = variables.rbegin(); it != variables.rend(); it++) {
-    if (it->count(id) > 0) {
-      return (*it)[id];
+void CodeGenerator::set_target() {
+  llvm::InitializeNativeTarget();
+  std::string triple = llvm::sys::getDefaultTargetTriple();
+  std::string message;
+  const llvm::Target *target =
+      llvm::TargetRegistry::lookupTarget(triple, message);
+  if (target == nullptr) {
+    error("Warning: no target for %s (%s), leaving it unset", triple.c_str(),
+          message.c_str());
+    return;
+  }
+
+  std::string &cpu = options.target_cpu, &features = options.target_features;
+  if (cpu == "native") {
+    cpu = llvm::sys::getHostCPUName().str();
+    if (features.empty()) {
+      features = "native";
+    }
+  }
+  if (features == "native") {
+    llvm::StringMap<bool> host_features;
+    std::vector<std::string> list;
+    if (llvm::sys::getHostCPUFeatures(host_features)) {
+      for (auto &feature : host_features) {
+        list.push_back((feature.second ? "+" : "-") + feature.first().str());
+      }
+    }
+    // (sorted, so that the output doesn't depend on hashing)
+    std::sort(list.begin(), list.end());
+    features.clear();
+    for (auto &feature : list) {
+      features += (features.empty() ? "" : ",") + feature;
     }
   }
-  return nullptr;
-}
 
-void CodeGenerator::SymbolTable::add_array(std::string id, int length) {
-  array_lengths[id] = length;
+  std::unique_ptr<llvm::MCSubtargetInfo> subtarget(
+      target->createMCSubtargetInfo(triple, "", ""));
+  if (!cpu.empty() && !subtarget->isCPUStringValid(cpu)) {
+    error("Warning: unknown target CPU %s, ignored", cpu.c_str());
+    cpu.clear();
+  }
+
+  std::unique_ptr<llvm::TargetMachine> machine(target->createTargetMachine(
+      triple, cpu, features, llvm::TargetOptions(), llvm::None));
+  module->setTargetTriple(triple);
+  module->setDataLayout(machine->createDataLayout());
 }
-int CodeGenerator::SymbolTable::get_array_len(std::string id) {
-  return array_lengths[id];
+
+void CodeGenerator::add_target_attributes(llvm::Function *func) {
+  if (!options.target_cpu.empty()) {
+    func->addFnAttr("target-cpu", options.target_cpu);
+  }
+  if (!options.target_features.empty()) {
+    func->addFnAttr("target-features", options.target_features);
+  }
 }
 
-bool CodeGenerator::SymbolTable::is_global_scope() { return variables.empty(); }
+void CodeGenerator::add_effect_attributes(llvm::Function *func,
+                                          const MethodEffects &effects) {
+  if (effects.unknown)
+    return;
 
-/*** CodeGenerator ***/
-CodeGenerator::CodeGenerator(std::string name) : builder(context) {
-  module = new llvm::Module(name, context);
-  has_error = false;
-}
-CodeGenerator::~CodeGenerator() { delete module; }
+  // (runtime errors print, so they count as I/O: the runtime's own memory)
+  bool inaccessible = effects.io || effects.fails;
+  func->addFnAttr(llvm::Attribute::NoUnwind);
+  if (!effects.recursive) {
+    func->addFnAttr(llvm::Attribute::NoRecurse);
+  }
+  if (!inaccessible) {
+    func->addFnAttr(llvm::Attribute::NoSync);
+    if (!effects.loops && !effects.recursive) {
+      func->addFnAttr(llvm::Attribute::WillReturn);
+    }
+  }
 
-void CodeGenerator::add_builtin(std::string name,
-                                std::vector<ValueType> _params, ValueType ret) {
-  if (module->getFunction(name) != nullptr)
+  if (effects.writes_globals)
     return;
+  if (effects.reads_globals) {
+    if (!inaccessible) {
+      func->addFnAttr(llvm::Attribute::ReadOnly);
+    }
+  } else if (inaccessible) {
+    func->addFnAttr(llvm::Attribute::InaccessibleMemOnly);
+  } else {
+    func->addFnAttr(llvm::Attribute::ReadNone);
+  }
+}
+
+llvm::Function *CodeGenerator::add_builtin(std::string name,
+                                           std::vector<ValueType> _params,
+                                           ValueType ret) {
+  llvm::Function *func = module->getFunction(name);
+  if (func != nullptr)
+    return func;
+
+  // (exact prototypes: semantic analysis made all the calls agree)
+  std::vector<llvm::Type *> params;
+  for (auto param : _params) {
+    params.push_back(get_llvm_type(param));
+  }
+  llvm::FunctionType *ftype =
+      llvm::FunctionType::get(get_llvm_type(ret), params, false);
+  func = llvm::Function::Create(ftype, llvm::Function::ExternalLinkage, name,
+                                module);
+  for (unsigned i = 0; i < _params.size(); i++) {
+    if (_params[i] == ValueType::BOOL) {
+      func->addParamAttr(i, llvm::Attribute::ZExt); // (a C++ bool)
+    }
+  }
 
-  llvm::Type *ret_type = get_llvm_type(ret);
-  llvm::FunctionType *ftype = llvm::FunctionType::get(ret_type, true);
-  llvm::Function::Create(ftype, llvm::Function::ExternalLinkage, name, module);
+  // what the runtime's builtins do: they don't throw, and only access their
+  // own state (invisible to the program), and the arrays/strings passed
+  auto builtin = find_builtin(name);
+  if (builtin == nullptr)
+    return func;
+  func->addFnAttr(llvm::Attribute::NoUnwind);
+  if (builtin->memory == BuiltinSignature::Memory::NONE) {
+    func->addFnAttr(llvm::Attribute::InaccessibleMemOnly);
+    return func;
+  }
+  func->addFnAttr(llvm::Attribute::InaccessibleMemOrArgMemOnly);
+  for (unsigned i = 0; i < params.size(); i++) {
+    if (!params[i]->isPointerTy())
+      continue;
+    func->addParamAttr(i, llvm::Attribute::NoCapture);
+    func->addParamAttr(i, builtin->memory ==
+                                  BuiltinSignature::Memory::READS_ARGUMENTS
+                              ? llvm::Attribute::ReadOnly
+                              : llvm::Attribute::WriteOnly);
+  }
+  return func;
 }
 
-void CodeGenerator::generate(BaseAST &root) {
-  // add decl for exit, write_string
-  add_builtin("exit", std::vector<ValueType>(1, ValueType::INT),
-              ValueType::VOID);
-  add_builtin("write_string", std::vector<ValueType>(1, ValueType::STRING),
-              ValueType::INT);
+bool CodeGenerator::generate(BaseAST &root) {
+  // add decl for decaf_runtime_error (message, name, location, exit code)
+  llvm::Function *error = add_builtin(
+      "decaf_runtime_error",
+      {ValueType::STRING, ValueType::STRING, ValueType::STRING, ValueType::INT},
+      ValueType::VOID);
+  error->addFnAttr(llvm::Attribute::NoReturn);
+  error->addFnAttr(llvm::Attribute::NoUnwind);
 
   /** generate code **/
   root.accept(*this);
+  layout_globals();
+
+  if (!options.runtime.empty() && !link_runtime()) {
+    has_error = true;
+  }
+  return !has_error;
+}
+
+void CodeGenerator::layout_globals() {
+  std::map<llvm::GlobalVariable *, double> accesses;
+  for (auto &func : *module) {
+    if (func.isDeclaration())
+      continue;
+    llvm::DominatorTree dominators(func);
+    llvm::LoopInfo loops(dominators);
+    for (auto &block : func) {
+      double weight = std::pow(LOOP_WEIGHT, loops.getLoopDepth(&block));
+      for (auto &inst : block) {
+        for (auto &operand : inst.operands()) {
+          auto var = llvm::dyn_cast<llvm::GlobalVariable>(
+              operand->stripPointerCasts());
+          if (var != nullptr) {
+            accesses[var] += weight;
+          }
+        }
+      }
+    }
+  }
+
+  std::vector<llvm::GlobalVariable *> scalars, arrays;
+  for (auto var : global_slots) {
+    if (var->getValueType()->isArrayTy()) {
+      arrays.push_back(var);
+    } else {
+      scalars.push_back(var);
+    }
+  }
+  std::stable_sort(scalars.begin(), scalars.end(),
+                   [&](llvm::GlobalVariable *a, llvm::GlobalVariable *b) {
+                     return accesses[a] > accesses[b];
+                   });
+
+  // (globals are emitted in the order of the module's list)
+  auto &globals = module->getGlobalList();
+  for (auto var : scalars) {
+    var->removeFromParent();
+    globals.push_back(var);
+  }
+  if (!scalars.empty()) {
+    scalars.front()->setAlignment(llvm::Align(CACHE_LINE));
+  }
+  const llvm::DataLayout &layout = module->getDataLayout();
+  for (auto var : arrays) {
+    var->removeFromParent();
+    globals.push_back(var);
+    uint64_t size = layout.getTypeAllocSize(var->getValueType());
+    var->setAlignment(llvm::Align(size >= HUGE_PAGE ? HUGE_PAGE : CACHE_LINE));
+  }
+}
+
+bool CodeGenerator::link_runtime() {
+  llvm::SMDiagnostic diagnostic;
+  std::unique_ptr<llvm::Module> runtime =
+      llvm::parseIRFile(options.runtime, diagnostic, context);
+  if (runtime == nullptr) {
+    error("Error: unable to read runtime %s: %s", options.runtime.c_str(),
+          diagnostic.getMessage().str().c_str());
+    return false;
+  }
+
+  // (built for the default CPU: its functions get the ones the program is
+  // built for, as a callee needing features the caller lacks isn't inlined)
+  runtime->setTargetTriple(module->getTargetTriple());
+  runtime->setDataLayout(module->getDataLayout());
+  for (auto &func : *runtime) {
+    if (func.isDeclaration())
+      continue;
+    func.removeFnAttr("target-cpu");
+    func.removeFnAttr("target-features");
+    func.removeFnAttr("tune-cpu");
+    add_target_attributes(&func);
+  }
+
+  // the runtime's state becomes globals of the module, which the builtins
+  // access: the methods doing I/O (or failing) no longer access only
+  // inaccessible memory
+  for (auto &func : *module) {
+    func.removeFnAttr(llvm::Attribute::InaccessibleMemOnly);
+    func.removeFnAttr(llvm::Attribute::InaccessibleMemOrArgMemOnly);
+  }
+
+  // (only the builtins the program uses, and what they use)
+  if (llvm::Linker::linkModules(*module, std::move(runtime),
+                                llvm::Linker::Flags::LinkOnlyNeeded)) {
+    error("Error: unable to link runtime %s", options.runtime.c_str());
+    return false;
+  }
+  // only main is called from outside the program
+  llvm::internalizeModule(*module, [](const llvm::GlobalValue &value) {
+    return value.getName() == "main";
+  });
+  return true;
 }
 
 void CodeGenerator::print(std::string outf) {
   if (outf != "") {
     std::error_code EC;
-    llvm::raw_fd_ostream out(outf, EC, llvm::sys::fs::F_None);
+    llvm::raw_fd_ostream out(outf, EC, llvm::sys::fs::OF_None);
     if (EC) {
       std::cerr << "Error writing to file " << outf << "\n";
       return;
@@ -95,10 +314,97 @@ llvm::Value *CodeGenerator::get_return_stack_top(bool pop) {
   return res;
 }
 llvm::Value *CodeGenerator::get_return(BaseAST &node) {
-  node.accept(*this);
+  work.run(node, *this);
   return get_return_stack_top();
 }
 
+void CodeGenerator::push_value(BaseAST &node, llvm::Value *value) {
+  // every expression reaching codegen was typed by semantic analysis
+  assert(value->getType() == get_llvm_type(node.expr_type));
+  return_stack.push(value);
+}
+
+llvm::Value *CodeGenerator::get_storage(VariableDeclarationAST *decl) {
+  if (decl->is_global) {
+    auto it = reduction_slots.find(decl);
+    if (it != reduction_slots.end())
+      return it->second;
+    return global_slots[decl->slot];
+  }
+  return local_slots[decl->slot];
+}
+
+llvm::ArrayType *CodeGenerator::get_array_type(ArrayDeclarationAST *decl) {
+  if (is_packed(decl)) {
+    return llvm::ArrayType::get(llvm::Type::getInt64Ty(context),
+                                (decl->array_len + 63) / 64);
+  }
+  return llvm::ArrayType::get(get_llvm_type(decl->type), decl->array_len);
+}
+
+bool CodeGenerator::is_packed(ArrayDeclarationAST *decl) {
+  return options.pack_bools && decl->type == ValueType::BOOL;
+}
+
+llvm::Value *CodeGenerator::get_array(ArrayDeclarationAST *decl) {
+  llvm::GlobalVariable *var = global_slots[decl->slot];
+  if (!options.mapped_arrays.count(decl->id))
+    return var;
+
+  auto it = mapped_bases.find(decl);
+  if (it != mapped_bases.end())
+    return it->second;
+
+  // (in the entry block: the address never changes once main has started)
+  llvm::BasicBlock &entry =
+      builder.GetInsertBlock()->getParent()->getEntryBlock();
+  llvm::IRBuilder<> entry_builder(&entry, entry.begin());
+  llvm::LoadInst *base =
+      entry_builder.CreateLoad(var->getValueType(), var, decl->id);
+  base->setMetadata(llvm::LLVMContext::MD_nonnull,
+                    llvm::MDNode::get(context, {}));
+  base->setMetadata(
+      llvm::LLVMContext::MD_dereferenceable,
+      llvm::MDNode::get(context, llvm::ConstantAsMetadata::get(
+                                     llvm::ConstantInt::get(
+                                         llvm::Type::getInt64Ty(context),
+                                         4ULL * decl->array_len))));
+  mapped_bases[decl] = base;
+  return base;
+}
+
+void CodeGenerator::add_array_mappings() {
+  if (mapped_arrays.empty())
+    return;
+
+  llvm::Type *i32 = llvm::Type::getInt32Ty(context);
+  llvm::FunctionCallee map = module->getOrInsertFunction(
+      "decaf_map_array", llvm::Type::getInt32PtrTy(context),
+      llvm::Type::getInt8PtrTy(context), llvm::Type::getInt8PtrTy(context),
+      i32, i32);
+  for (auto decl : mapped_arrays) {
+    auto &mapping = options.mapped_arrays[decl->id];
+    llvm::Value *data = builder.CreateCall(
+        map, {get_string(decl->id), get_string(mapping.path),
+              llvm::ConstantInt::get(i32, decl->array_len),
+              llvm::ConstantInt::get(i32, mapping.writable)});
+    llvm::Value *base = builder.CreateBitCast(
+        data, get_array_type(decl)->getPointerTo(), decl->id);
+    builder.CreateStore(base, global_slots[decl->slot]);
+    mapped_bases[decl] = base;
+  }
+}
+
+llvm::AllocaInst *CodeGenerator::add_local(VariableDeclarationAST *decl) {
+  llvm::BasicBlock &entry =
+      builder.GetInsertBlock()->getParent()->getEntryBlock();
+  llvm::IRBuilder<> entry_builder(&entry, entry.begin());
+  llvm::AllocaInst *alloca =
+      entry_builder.CreateAlloca(get_llvm_type(decl->type), 0, decl->id);
+  local_slots[decl->slot] = alloca;
+  return alloca;
+}
+
 llvm::Type *CodeGenerator::get_llvm_type(ValueType ty) {
   if (ty == ValueType::INT) {
     return llvm::Type::getInt32Ty(context);
@@ -112,38 +418,182 @@ llvm::Type *CodeGenerator::get_llvm_type(ValueType ty) {
   if (ty == ValueType::STRING) {
     return llvm::Type::getInt8PtrTy(context);
   }
+  if (ty == ValueType::INT_ARRAY) {
+    return llvm::Type::getInt32PtrTy(context);
+  }
 
   return nullptr;
 }
 
-void CodeGenerator::add_runtime_error_inst(int ec, std::string err) {
-  {
-    llvm::Value *ev = builder.CreateGlobalStringPtr(
-        "Runtime error: " + err + "\n", "error_message");
-    llvm::Function *func = module->getFunction("write_string");
-    std::vector<llvm::Value *> args;
-    args.push_back(ev);
-    builder.CreateCall(func, args, "errtmp");
+llvm::Constant *CodeGenerator::get_string(const std::string &str) {
+  auto it = strings.find(str);
+  if (it != strings.end())
+    return it->second;
+
+  llvm::Constant *res = builder.CreateGlobalStringPtr(str, "str", 0, module);
+  strings[str] = res;
+  return res;
+}
+
+llvm::Function *CodeGenerator::get_error_function(RuntimeError kind) {
+  auto it = error_functions.find(kind);
+  if (it != error_functions.end())
+    return it->second;
+
+  std::string name, message;
+  int exit_code;
+  if (kind == RuntimeError::ARRAY_BOUNDS) {
+    name = "decaf.array_bounds_error";
+    message = "Array access out of bounds: ";
+    exit_code = 1;
+  } else {
+    name = "decaf.missing_return_error";
+    message = "Control reaches end of function ";
+    exit_code = 2;
   }
-  {
-    llvm::Function *func = module->getFunction("exit");
-    std::vector<llvm::Value *> args;
-    args.push_back(llvm::ConstantInt::get(context, llvm::APInt(32, ec)));
-    builder.CreateCall(func, args);
+
+  // void (i8 *name, i8 *location)
+  llvm::Type *str_type = llvm::Type::getInt8PtrTy(context);
+  llvm::FunctionType *func_type = llvm::FunctionType::get(
+      llvm::Type::getVoidTy(context), {str_type, str_type}, false);
+  llvm::Function *func = llvm::Function::Create(
+      func_type, llvm::Function::InternalLinkage, name, module);
+  func->addFnAttr(llvm::Attribute::Cold);
+  func->addFnAttr(llvm::Attribute::NoReturn);
+  func->addFnAttr(llvm::Attribute::NoInline);
+  add_target_attributes(func);
+  error_functions[kind] = func;
+
+  llvm::IRBuilderBase::InsertPointGuard guard(builder);
+  builder.SetInsertPoint(llvm::BasicBlock::Create(context, "entry", func));
+
+  // Runtime error: <message><name> [<location>] (see io.cc)
+  builder.CreateCall(
+      module->getFunction("decaf_runtime_error"),
+      {get_string(message), func->getArg(0), func->getArg(1),
+       llvm::ConstantInt::get(context, llvm::APInt(32, exit_code))});
+  builder.CreateUnreachable();
+
+  return func;
+}
+
+void CodeGenerator::add_runtime_check(llvm::Value *cond, RuntimeError kind,
+                                      const std::string &name,
+                                      const std::string &location) {
+  llvm::Function *func = builder.GetInsertBlock()->getParent();
+
+  auto it = error_blocks.find(kind);
+  if (it == error_blocks.end()) {
+    llvm::IRBuilderBase::InsertPointGuard guard(builder);
+    llvm::BasicBlock *errorBB =
+        llvm::BasicBlock::Create(context, "runtime-error", func);
+    builder.SetInsertPoint(errorBB);
+
+    llvm::Type *str_type = llvm::Type::getInt8PtrTy(context);
+    llvm::PHINode *name_phi = builder.CreatePHI(str_type, 2, "error-name");
+    llvm::PHINode *location_phi =
+        builder.CreatePHI(str_type, 2, "error-location");
+    builder.CreateCall(get_error_function(kind), {name_phi, location_phi});
+    builder.CreateUnreachable();
+
+    it = error_blocks.emplace(kind, ErrorBlock{errorBB, name_phi, location_phi})
+             .first;
   }
-  {
-    // dummy ret, to avoid IR error
-    llvm::Function *func = builder.GetInsertBlock()->getParent();
-    if (func->getReturnType()->isVoidTy()) {
-      builder.CreateRetVoid();
-    } else if (func->getReturnType()->isIntegerTy(32)) {
-      builder.CreateRet(llvm::ConstantInt::get(context, llvm::APInt(32, 0)));
-    } else if (func->getReturnType()->isIntegerTy(1)) {
-      builder.CreateRet(llvm::ConstantInt::get(context, llvm::APInt(1, 0)));
+
+  llvm::BasicBlock *passBB =
+      llvm::BasicBlock::Create(context, "check-pass", func);
+  // (checks are expected to pass)
+  llvm::MDNode *weights = llvm::MDBuilder(context).createBranchWeights(
+      LIKELY_WEIGHT, UNLIKELY_WEIGHT);
+  builder.CreateCondBr(cond, passBB, it->second.block, weights);
+  it->second.name->addIncoming(get_string(name), builder.GetInsertBlock());
+  it->second.location->addIncoming(get_string(location),
+                                   builder.GetInsertBlock());
+
+  builder.SetInsertPoint(passBB);
+}
+
+void CodeGenerator::add_bounds_check(llvm::Value *index,
+                                     ArrayDeclarationAST *decl,
+                                     const std::string &location) {
+  // (unsigned, so that negative indices fail as well)
+  llvm::Value *in_bounds = builder.CreateICmpULT(
+      index, llvm::ConstantInt::get(index->getType(), decl->array_len),
+      "in-bounds");
+  add_runtime_check(in_bounds, RuntimeError::ARRAY_BOUNDS, decl->id,
+                    location);
+}
+
+void CodeGenerator::add_count_check(llvm::Value *count,
+                                    ArrayDeclarationAST *decl,
+                                    const std::string &location) {
+  llvm::Value *in_bounds = builder.CreateICmpULE(
+      count, llvm::ConstantInt::get(count->getType(), decl->array_len),
+      "in-bounds");
+  add_runtime_check(in_bounds, RuntimeError::ARRAY_BOUNDS, decl->id,
+                    location);
+}
+
+void CodeGenerator::add_hoisted_checks(ForStatementAST &node,
+                                       llvm::Value *start, llvm::Value *end) {
+  llvm::Type *i64 = llvm::Type::getInt64Ty(context);
+  llvm::Value *first = builder.CreateSExt(start, i64, "iter-first");
+  llvm::Value *last =
+      builder.CreateSub(builder.CreateSExt(end, i64, "iter-end"),
+                        llvm::ConstantInt::get(i64, 1), "iter-last");
+  llvm::Value *iter = get_storage(node.iterator);
+
+  for (auto access : node.hoisted_checks) {
+    // the index is a * iterator + b (wrapping to 32 bits): get a and b by
+    // evaluating it at 0 and 1
+    builder.CreateStore(llvm::ConstantInt::get(context, llvm::APInt(32, 0)),
+                        iter);
+    llvm::Value *b = get_return(*access->index_expr);
+    builder.CreateStore(llvm::ConstantInt::get(context, llvm::APInt(32, 1)),
+                        iter);
+    llvm::Value *a =
+        builder.CreateSub(get_return(*access->index_expr), b, "index-step");
+    a = builder.CreateSExt(a, i64, "index-step");
+    b = builder.CreateSExt(b, i64, "index-base");
+
+    // exact indices at both ends: if they are in bounds, so is every index
+    // in between (and none of them wrap)
+    auto decl = static_cast<ArrayDeclarationAST *>(access->decl);
+    for (auto iter_value : {first, last}) {
+      llvm::Value *index = builder.CreateAdd(
+          builder.CreateMul(a, iter_value, "index-step"), b, "index");
+      add_bounds_check(index, decl, access->location);
     }
   }
 }
 
+llvm::MDNode *CodeGenerator::get_loop_metadata(bool finite,
+                                               bool vectorizable) {
+  std::vector<llvm::Metadata *> properties;
+  if (finite) {
+    properties.push_back(llvm::MDNode::get(
+        context, llvm::MDString::get(context, "llvm.loop.mustprogress")));
+  }
+  if (options.vectorize && vectorizable) {
+    properties.push_back(llvm::MDNode::get(
+        context,
+        {llvm::MDString::get(context, "llvm.loop.vectorize.enable"),
+         llvm::ConstantAsMetadata::get(llvm::ConstantInt::getTrue(context))}));
+  }
+  if (properties.empty())
+    return nullptr;
+
+  // (distinct, and referring to itself, as loop IDs must)
+  properties.insert(properties.begin(), nullptr);
+  llvm::MDNode *loop_id = llvm::MDNode::getDistinct(context, properties);
+  loop_id->replaceOperandWith(0, loop_id);
+  return loop_id;
+}
+
+bool CodeGenerator::is_terminated() {
+  return builder.GetInsertBlock()->getTerminator() != nullptr;
+}
+
 void CodeGenerator::error(const std::string &fmt, ...) {
   static const int SIZE = 300;
   std::string err(SIZE, '\0');
@@ -152,6 +602,7 @@ void CodeGenerator::error(const std::string &fmt, ...) {
   va_start(args, fmt);
   vsnprintf(&err[0], SIZE, fmt.c_str(), args);
   va_end(args);
+  err.resize(strlen(err.c_str()));
 
   std::cerr << err << '\n';
 }
@@ -168,15 +619,15 @@ void CodeGenerator::visit(LiteralAST &node) {
 void CodeGenerator::visit(IntegerLiteralAST &node) {
   llvm::Value *value =
       llvm::ConstantInt::get(context, llvm::APInt(32, node.value));
-  return_stack.push(value);
+  push_value(node, value);
 }
 void CodeGenerator::visit(BooleanLiteralAST &node) {
   llvm::Value *value =
       llvm::ConstantInt::get(context, llvm::APInt(1, node.value));
-  return_stack.push(value);
+  push_value(node, value);
 }
 void CodeGenerator::visit(StringLiteralAST &node) {
-  return_stack.push(builder.CreateGlobalStringPtr(node.value, "literal"));
+  push_value(node, get_string(node.value));
 }
 
 // variables.hh
@@ -184,92 +635,147 @@ void CodeGenerator::visit(LocationAST &node) {
   throw invalid_call_error(__PRETTY_FUNCTION__);
 }
 void CodeGenerator::visit(VariableLocationAST &node) {
-  llvm::Value *var = symbol_table.lookup_variable(node.id);
-  if (var == nullptr) {
-    var = module->getNamedGlobal(node.id);
-  }
-  if (!node.is_lvalue) {
-    var = builder.CreateLoad(var, node.id);
+  llvm::Value *var = get_storage(node.decl);
+  if (node.is_lvalue) {
+    return_stack.push(var);
+    return;
   }
-  return_stack.push(var);
+  push_value(node, builder.CreateLoad(get_llvm_type(node.expr_type), var,
+                                      node.id));
 }
 void CodeGenerator::visit(ArrayLocationAST &node) {
-  llvm::Value *var = module->getNamedGlobal(node.id);
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.index_expr});
+    return;
+  }
+
+  auto decl = static_cast<ArrayDeclarationAST *>(node.decl);
   std::vector<llvm::Value *> index;
   index.push_back(llvm::ConstantInt::get(context, llvm::APInt(64, 0)));
-  index.push_back(get_return(*node.index_expr));
-
-  llvm::Function *func = builder.GetInsertBlock()->getParent();
-
-  llvm::BasicBlock *lowerBoundPassBB =
-      llvm::BasicBlock::Create(context, "array-bound-lower", func);
-  llvm::BasicBlock *upperBoundPassBB =
-      llvm::BasicBlock::Create(context, "array-bound-upper", func);
-  llvm::BasicBlock *errorBB =
-      llvm::BasicBlock::Create(context, "array-out-of-bounds", func);
+  index.push_back(get_return_stack_top());
 
-  llvm::Value *lower_bound_cond = builder.CreateICmpSGE(
-      index[1], llvm::ConstantInt::get(context, llvm::APInt(32, 0)),
-      "array-bound-ge-0");
-  builder.CreateCondBr(lower_bound_cond, lowerBoundPassBB, errorBB);
-  builder.SetInsertPoint(lowerBoundPassBB);
+  // (unless proven in bounds by range analysis, or hoisted)
+  if (node.needs_bounds_check &&
+      options.bounds != Options::BoundsChecks::OFF) {
+    add_bounds_check(index[1], decl, node.location);
+  }
 
-  int array_len = symbol_table.get_array_len(node.id);
-  llvm::Value *upper_bound_cond = builder.CreateICmpSLT(
-      index[1], llvm::ConstantInt::get(context, llvm::APInt(32, array_len)),
-      "array-bound-lt-size");
-  builder.CreateCondBr(upper_bound_cond, upperBoundPassBB, errorBB);
+  if (is_packed(decl)) {
+    // (the index is in bounds, so non-negative)
+    llvm::Type *i64 = llvm::Type::getInt64Ty(context);
+    llvm::Value *element = builder.CreateZExt(index[1], i64, "element");
+    index[1] = builder.CreateLShr(element, 6, "word-index");
+    llvm::Value *bit =
+        builder.CreateAnd(element, llvm::ConstantInt::get(i64, 63), "bit");
+    llvm::Value *word_ptr = builder.CreateGEP(
+        get_array_type(decl), get_array(decl), index, "array_word");
+    if (node.is_lvalue) {
+      packed_bit = bit;
+      return_stack.push(word_ptr);
+      return;
+    }
 
-  builder.SetInsertPoint(errorBB);
-  add_runtime_error_inst(1, "Array access out of bounds: " + node.id);
+    llvm::LoadInst *word = builder.CreateLoad(i64, word_ptr, "word");
+    if (in_parallel_body) {
+      word->setAtomic(llvm::AtomicOrdering::Monotonic);
+    }
+    push_value(node, builder.CreateTrunc(builder.CreateLShr(word, bit),
+                                         builder.getInt1Ty(), node.id));
+    return;
+  }
 
-  builder.SetInsertPoint(upperBoundPassBB);
+  llvm::Value *ptr = builder.CreateGEP(get_array_type(decl), get_array(decl),
+                                       index, "array_location");
 
-  var = builder.CreateGEP(var, index, "array_location");
+  if (node.is_lvalue) {
+    return_stack.push(ptr);
+    return;
+  }
+  push_value(node,
+             builder.CreateLoad(get_llvm_type(node.expr_type), ptr, node.id));
+}
 
-  if (!node.is_lvalue) {
-    var = builder.CreateLoad(var, node.id);
+void CodeGenerator::add_packed_store(llvm::Value *word_ptr, llvm::Value *bit,
+                                     llvm::Value *value) {
+  llvm::Type *i64 = llvm::Type::getInt64Ty(context);
+  value = builder.CreateZExt(value, i64);
+  llvm::LoadInst *word = builder.CreateLoad(i64, word_ptr, "word");
+
+  if (in_parallel_body) {
+    // flip the bit if it differs (no other thread changes it)
+    word->setAtomic(llvm::AtomicOrdering::Monotonic);
+    llvm::Value *differs = builder.CreateAnd(
+        builder.CreateXor(builder.CreateLShr(word, bit), value),
+        llvm::ConstantInt::get(i64, 1));
+    builder.CreateAtomicRMW(llvm::AtomicRMWInst::Xor, word_ptr,
+                            builder.CreateShl(differs, bit),
+                            llvm::MaybeAlign(),
+                            llvm::AtomicOrdering::Monotonic);
+    return;
   }
 
-  return_stack.push(var);
+  llvm::Value *mask = builder.CreateShl(llvm::ConstantInt::get(i64, 1), bit);
+  llvm::Value *cleared = builder.CreateAnd(word, builder.CreateNot(mask));
+  builder.CreateStore(
+      builder.CreateOr(cleared, builder.CreateShl(value, bit), "word"),
+      word_ptr);
 }
 
 void CodeGenerator::visit(ArrayAddressAST &node) {
-  llvm::Value *var = module->getNamedGlobal(node.id);
+  auto decl = static_cast<ArrayDeclarationAST *>(node.decl);
 
   std::vector<llvm::Value *> index;
   index.push_back(llvm::ConstantInt::get(context, llvm::APInt(64, 0)));
   index.push_back(llvm::ConstantInt::get(context, llvm::APInt(64, 0)));
 
-  var = builder.CreateGEP(var, index, "array_address");
+  llvm::Value *ptr = builder.CreateGEP(get_array_type(decl), get_array(decl),
+                                       index, "array_address");
 
-  return_stack.push(var);
+  push_value(node, ptr);
 }
 
 void CodeGenerator::visit(VariableDeclarationAST &node) {
   auto type = get_llvm_type(node.type);
   auto init = llvm::Constant::getNullValue(type);
-  if (symbol_table.is_global_scope()) { // global variable
+  if (node.is_global) { // global variable
     llvm::GlobalVariable *var = new llvm::GlobalVariable(
         *module, type, false, llvm::GlobalValue::InternalLinkage, nullptr,
         node.id);
     var->setInitializer(init);
-  } else { // local/block variable
-    llvm::AllocaInst *alloca = builder.CreateAlloca(type, 0, node.id);
-    builder.CreateStore(init, alloca);
-    symbol_table.add_variable(node.id, alloca);
-    return_stack.push(alloca);
+    global_slots[node.slot] = var;
+  } else { // local/block variable, (re)initialized where it is declared
+    builder.CreateStore(init, add_local(&node));
   }
 }
 
 void CodeGenerator::visit(ArrayDeclarationAST &node) {
-  llvm::ArrayType *type =
-      llvm::ArrayType::get(get_llvm_type(node.type), node.array_len);
+  llvm::ArrayType *type = get_array_type(&node);
+  auto mapping = options.mapped_arrays.find(node.id);
+  if (mapping != options.mapped_arrays.end()) {
+    if (node.type != ValueType::INT) {
+      error("Error: --map: array `%s` is not an int array", node.id.c_str());
+      has_error = true;
+    }
+    if (!mapping->second.writable && node.assign_count > 0) {
+      error("Error: --map-ro: array `%s` is assigned to", node.id.c_str());
+      has_error = true;
+    }
+
+    // (the address it is mapped at)
+    llvm::PointerType *ptr_type = type->getPointerTo();
+    llvm::GlobalVariable *var = new llvm::GlobalVariable(
+        *module, ptr_type, false, llvm::GlobalValue::InternalLinkage,
+        llvm::ConstantPointerNull::get(ptr_type), node.id);
+    global_slots[node.slot] = var;
+    mapped_arrays.push_back(&node);
+    return;
+  }
+
   llvm::GlobalVariable *var = new llvm::GlobalVariable(
       *module, type, false, llvm::GlobalValue::InternalLinkage, nullptr,
       node.id);
   var->setInitializer(llvm::ConstantAggregateZero::get(type));
-  symbol_table.add_array(node.id, node.array_len);
+  global_slots[node.slot] = var;
 }
 
 // operators.hh
@@ -281,8 +787,13 @@ void CodeGenerator::visit(BinaryOperatorAST &node) {
 }
 
 void CodeGenerator::visit(ArithBinOperatorAST &node) {
-  llvm::Value *lvalue = get_return(*node.lval);
-  llvm::Value *rvalue = get_return(*node.rval);
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  llvm::Value *rvalue = get_return_stack_top();
+  llvm::Value *lvalue = get_return_stack_top();
 
   llvm::Value *value;
   if (node.op == OperatorType::ADD) {
@@ -297,26 +808,63 @@ void CodeGenerator::visit(ArithBinOperatorAST &node) {
     value = builder.CreateSRem(lvalue, rvalue, "Mod");
   }
 
-  return_stack.push(value);
+  push_value(node, value);
 }
 
 void CodeGenerator::visit(CondBinOperatorAST &node) {
-  llvm::Value *lvalue = get_return(*node.lval);
-  llvm::Value *rvalue = get_return(*node.rval);
+  // short-circuit: the right operand is only evaluated if the left one
+  // doesn't decide the result
+  bool is_and = node.op == OperatorType::AND;
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval});
+    return;
+  }
 
-  llvm::Value *value;
-  if (node.op == OperatorType::AND) {
-    value = builder.CreateAnd(lvalue, rvalue, "And");
-  } else if (node.op == OperatorType::OR) {
-    value = builder.CreateOr(lvalue, rvalue, "Or");
+  if (work.stage() == 1) {
+    llvm::Value *lvalue = get_return_stack_top();
+    llvm::Function *func = builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock *rhsBB =
+        llvm::BasicBlock::Create(context, is_and ? "and-rhs" : "or-rhs", func);
+    llvm::BasicBlock *afterBB = llvm::BasicBlock::Create(
+        context, is_and ? "and-cont" : "or-cont", func);
+
+    if (is_and) {
+      builder.CreateCondBr(lvalue, rhsBB, afterBB);
+    } else {
+      builder.CreateCondBr(lvalue, afterBB, rhsBB);
+    }
+    short_circuit_blocks.emplace(builder.GetInsertBlock(), afterBB);
+
+    builder.SetInsertPoint(rhsBB);
+    work.defer(node, 2, {node.rval});
+    return;
   }
 
-  return_stack.push(value);
+  llvm::Value *rvalue = get_return_stack_top();
+  auto blocks = short_circuit_blocks.top();
+  short_circuit_blocks.pop();
+  builder.CreateBr(blocks.second);
+  llvm::BasicBlock *rhsBB = builder.GetInsertBlock();
+
+  builder.SetInsertPoint(blocks.second);
+  llvm::PHINode *value = builder.CreatePHI(llvm::Type::getInt1Ty(context), 2,
+                                          is_and ? "And" : "Or");
+  // (the left operand decided the result)
+  value->addIncoming(llvm::ConstantInt::get(context, llvm::APInt(1, !is_and)),
+                     blocks.first);
+  value->addIncoming(rvalue, rhsBB);
+
+  push_value(node, value);
 }
 
 void CodeGenerator::visit(RelBinOperatorAST &node) {
-  llvm::Value *lvalue = get_return(*node.lval);
-  llvm::Value *rvalue = get_return(*node.rval);
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  llvm::Value *rvalue = get_return_stack_top();
+  llvm::Value *lvalue = get_return_stack_top();
 
   llvm::Value *value;
   if (node.op == OperatorType::LE) {
@@ -329,12 +877,17 @@ void CodeGenerator::visit(RelBinOperatorAST &node) {
     value = builder.CreateICmpSGT(lvalue, rvalue, "GT");
   }
 
-  return_stack.push(value);
+  push_value(node, value);
 }
 
 void CodeGenerator::visit(EqBinOperatorAST &node) {
-  llvm::Value *lvalue = get_return(*node.lval);
-  llvm::Value *rvalue = get_return(*node.rval);
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  llvm::Value *rvalue = get_return_stack_top();
+  llvm::Value *lvalue = get_return_stack_top();
 
   llvm::Value *value;
   if (node.op == OperatorType::EQ) {
@@ -343,23 +896,37 @@ void CodeGenerator::visit(EqBinOperatorAST &node) {
     value = builder.CreateICmpNE(lvalue, rvalue, "NE");
   }
 
-  return_stack.push(value);
+  push_value(node, value);
 }
 
 void CodeGenerator::visit(UnaryMinusAST &node) {
-  llvm::Value *value = get_return(*node.val);
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.val});
+    return;
+  }
+
+  llvm::Value *value = get_return_stack_top();
   value = builder.CreateNeg(value, "UnaryMinus");
-  return_stack.push(value);
+  push_value(node, value);
 }
 
 void CodeGenerator::visit(UnaryNotAST &node) {
-  llvm::Value *value = get_return(*node.val);
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.val});
+    return;
+  }
+
+  llvm::Value *value = get_return_stack_top();
   value = builder.CreateNot(value, "UnaryNot");
-  return_stack.push(value);
+  push_value(node, value);
 }
 
 // statements.hh
 void CodeGenerator::visit(ReturnStatementAST &node) {
+  auto call = dynamic_cast<MethodCallAST *>(node.ret_expr);
+  if (call != nullptr && add_tail_call(*call))
+    return;
+
   if (node.ret_expr == NULL) { // ret void
     builder.CreateRetVoid();
   } else { // ret val
@@ -368,33 +935,71 @@ void CodeGenerator::visit(ReturnStatementAST &node) {
   }
 }
 
+bool CodeGenerator::add_tail_call(MethodCallAST &call) {
+  // (callouts have no declaration)
+  if (call.decl == nullptr)
+    return false;
+  llvm::Function *func = builder.GetInsertBlock()->getParent();
+  llvm::Function *callee = method_slots[call.decl->slot];
+  if (callee->getFunctionType() != func->getFunctionType())
+    return false;
+
+  std::vector<llvm::Value *> args;
+  for (auto arg : call.arguments) {
+    args.push_back(get_return(*arg));
+  }
+
+  num_calls++;
+  if (callee == func) {
+    // (all the arguments are evaluated before any parameter is assigned)
+    for (unsigned i = 0; i < args.size(); i++) {
+      builder.CreateStore(args[i], get_storage(call.decl->parameters[i]));
+    }
+    builder.CreateBr(body_block);
+  } else {
+    llvm::CallInst *value = builder.CreateCall(callee, args, "tail-call");
+    value->setTailCallKind(llvm::CallInst::TCK_MustTail);
+    builder.CreateRet(value);
+  }
+  return true;
+}
+
 void CodeGenerator::visit(IfStatementAST &node) {
   llvm::Function *func = builder.GetInsertBlock()->getParent();
 
   llvm::Value *cond = get_return(*node.cond_expr);
-  cond = builder.CreateICmpEQ(
-      cond, llvm::ConstantInt::get(context, llvm::APInt(1, 1)), "ifcond");
 
   llvm::BasicBlock *thenBB = llvm::BasicBlock::Create(context, "then", func);
-  llvm::BasicBlock *elseBB = llvm::BasicBlock::Create(context, "else", func);
-  llvm::BasicBlock *afterBB =
-      llvm::BasicBlock::Create(context, "if-cont", func);
+  // (inserted once reachable)
+  llvm::BasicBlock *afterBB = llvm::BasicBlock::Create(context, "if-cont");
+  llvm::BasicBlock *elseBB =
+      node.else_block ? llvm::BasicBlock::Create(context, "else") : afterBB;
 
   builder.CreateCondBr(cond, thenBB, elseBB);
 
   // then block
   builder.SetInsertPoint(thenBB);
   node.then_block->accept(*this);
-  builder.CreateBr(afterBB);
+  if (!is_terminated()) {
+    builder.CreateBr(afterBB);
+  }
 
   // else block
-  builder.SetInsertPoint(elseBB);
   if (node.else_block) {
+    elseBB->insertInto(func);
+    builder.SetInsertPoint(elseBB);
     node.else_block->accept(*this);
+    if (!is_terminated()) {
+      builder.CreateBr(afterBB);
+    }
   }
-  builder.CreateBr(afterBB);
 
-  // continuation
+  // continuation, unless both branches return/break/continue
+  if (afterBB->use_empty()) {
+    delete afterBB;
+    return;
+  }
+  afterBB->insertInto(func);
   builder.SetInsertPoint(afterBB);
 }
 
@@ -407,69 +1012,302 @@ void CodeGenerator::visit(ContinueStatementAST &node) {
 }
 
 void CodeGenerator::visit(ForStatementAST &node) {
+  if (node.tile_size > 0 && !loop_ranges.count(&node)) {
+    add_tiled_nest(node);
+    return;
+  }
+  if (node.parallel && !loop_ranges.count(&node)) {
+    add_parallel_loop(node);
+    return;
+  }
+
   llvm::Function *func = builder.GetInsertBlock()->getParent();
 
-  symbol_table.block_start(); // for scope (contains iterator)
+  // loop iterator, and range (computed once, before the loop)
+  node.iterator->accept(*this);
+  // const to prevent modifications to iterator ptr
+  llvm::Value *const loop_iter = get_storage(node.iterator);
 
-  // pre-block: computes range, and initializes iterator
-  llvm::BasicBlock *preBB = llvm::BasicBlock::Create(context, "for-init", func);
-  llvm::BasicBlock *condBB =
-      llvm::BasicBlock::Create(context, "for-cond", func);
-  llvm::BasicBlock *midBB = llvm::BasicBlock::Create(context, "for-temp", func);
-  llvm::BasicBlock *incrBB =
-      llvm::BasicBlock::Create(context, "for-incr", func);
-  llvm::BasicBlock *afterBB =
-      llvm::BasicBlock::Create(context, "for-cont", func);
+  std::pair<llvm::Value *, llvm::Value *> range;
+  auto given = loop_ranges.find(&node);
+  if (given != loop_ranges.end()) {
+    // (the iterations in the current tile/chunk)
+    range = given->second;
+  } else {
+    range.first = get_return(*node.start_expr);
+    range.second = get_return(*node.end_expr);
+  }
+  llvm::Value *const init_val = range.first;
+  llvm::Value *const final_val = range.second;
 
-  builder.CreateBr(preBB);
-  builder.SetInsertPoint(preBB);
+  // The loop is rotated: the condition is checked once before entering it,
+  // and then at the end of each iteration (in the latch, for-incr).
+  llvm::BasicBlock *preBB =
+      llvm::BasicBlock::Create(context, "for-preheader", func);
+  // (inserted once reachable)
+  llvm::BasicBlock *bodyBB = llvm::BasicBlock::Create(context, "for-body");
+  llvm::BasicBlock *incrBB = llvm::BasicBlock::Create(context, "for-incr");
+  llvm::BasicBlock *afterBB = llvm::BasicBlock::Create(context, "for-cont");
 
-  // loop iterator
-  VariableDeclarationAST loop_iter_ast(node.iterator_id, ValueType::INT);
-  // const to prevent modifications to iterator ptr
-  llvm::Value *const loop_iter = get_return(loop_iter_ast);
+  llvm::Value *runs = builder.CreateICmpSLT(init_val, final_val, "for-runs");
+  builder.CreateCondBr(runs, preBB, afterBB);
 
-  llvm::Value *const init_val = get_return(*node.start_expr);
-  llvm::Value *const final_val = get_return(*node.end_expr);
+  builder.SetInsertPoint(preBB);
+  if (!node.hoisted_checks.empty()) {
+    add_hoisted_checks(node, init_val, final_val);
+  }
   builder.CreateStore(init_val, loop_iter);
-
-  // condition check
-  builder.CreateBr(condBB);
-  builder.SetInsertPoint(condBB);
-  llvm::Value *loop_iter_val = builder.CreateLoad(loop_iter, "iter-curr");
-  llvm::Value *cond =
-      builder.CreateICmpSLT(loop_iter_val, final_val, "for-cond-check");
-  builder.CreateCondBr(cond, midBB, afterBB);
+  bodyBB->insertInto(func);
+  builder.CreateBr(bodyBB);
 
   // loop body
-  builder.SetInsertPoint(midBB);
+  builder.SetInsertPoint(bodyBB);
 
   for_jump_blocks.emplace(incrBB, afterBB);
+  unsigned loops = num_loops++, calls = num_calls;
+  unsigned unbounded = num_unbounded_loops;
   node.block->accept(*this);
+  bool vectorizable = num_loops == loops + 1 && num_calls == calls;
   for_jump_blocks.pop();
 
+  // the iterator is below final_val, so the increment can't overflow
+  // (unless the body assigns to it); the loop terminates if no loop in it
+  // (itself included) has its iterator assigned
+  bool fixed_iter = node.iterator->assign_count == 0;
+  bool finite = fixed_iter && num_unbounded_loops == unbounded;
+  if (!fixed_iter) {
+    num_unbounded_loops++;
+  }
+
   // jump to increment block
-  builder.CreateBr(incrBB);
-  builder.SetInsertPoint(incrBB);
-  loop_iter_val = builder.CreateLoad(loop_iter, "iter-curr");
-  loop_iter_val = builder.CreateAdd(
-      loop_iter_val, llvm::ConstantInt::get(context, llvm::APInt(32, 1)),
-      "iter-incr");
-  builder.CreateStore(loop_iter_val, loop_iter);
-  builder.CreateBr(condBB); // jump to condition
+  if (!is_terminated()) {
+    builder.CreateBr(incrBB);
+  }
+  if (incrBB->use_empty()) {
+    // (every iteration returns or breaks)
+    delete incrBB;
+  } else {
+    incrBB->insertInto(func);
+    builder.SetInsertPoint(incrBB);
+    llvm::Value *loop_iter_val = builder.CreateLoad(
+        llvm::Type::getInt32Ty(context), loop_iter, "iter-curr");
+    loop_iter_val = builder.CreateAdd(
+        loop_iter_val, llvm::ConstantInt::get(context, llvm::APInt(32, 1)),
+        "iter-incr", false, fixed_iter);
+    builder.CreateStore(loop_iter_val, loop_iter);
+
+    // condition check
+    llvm::Value *cond =
+        builder.CreateICmpSLT(loop_iter_val, final_val, "for-cond-check");
+    llvm::BranchInst *latch = builder.CreateCondBr(cond, bodyBB, afterBB);
+    if (llvm::MDNode *loop_id = get_loop_metadata(finite, vectorizable)) {
+      latch->setMetadata(llvm::LLVMContext::MD_loop, loop_id);
+    }
+  }
 
   // restore to continuation
+  afterBB->insertInto(func);
   builder.SetInsertPoint(afterBB);
+}
+
+void CodeGenerator::add_tiled_nest(ForStatementAST &root) {
+  // the loops of the nest, and their bounds (which don't depend on the
+  // iterators, so they are evaluated once)
+  std::vector<ForStatementAST *> nest;
+  std::vector<std::pair<llvm::Value *, llvm::Value *>> bounds;
+  for (ForStatementAST *loop = &root; loop && loop->tile_size > 0;) {
+    nest.push_back(loop);
+    llvm::Value *start = get_return(*loop->start_expr);
+    bounds.emplace_back(start, get_return(*loop->end_expr));
+
+    auto block = static_cast<StatementBlockAST *>(loop->block);
+    loop = block->statements.size() == 1
+               ? dynamic_cast<ForStatementAST *>(block->statements[0])
+               : nullptr;
+  }
+
+  add_tile_loops(nest, bounds, 0);
+}
+
+void CodeGenerator::add_tile_loops(
+    std::vector<ForStatementAST *> &nest,
+    std::vector<std::pair<llvm::Value *, llvm::Value *>> &bounds,
+    unsigned level) {
+  if (level == nest.size()) {
+    // the loops of the nest, over the current tiles
+    nest[0]->accept(*this);
+    return;
+  }
+
+  llvm::Function *func = builder.GetInsertBlock()->getParent();
+  llvm::Value *start = bounds[level].first, *end = bounds[level].second;
+  llvm::BasicBlock *preBB = builder.GetInsertBlock();
+  llvm::BasicBlock *tileBB = llvm::BasicBlock::Create(context, "tile", func);
+  // (inserted after the tile)
+  llvm::BasicBlock *afterBB = llvm::BasicBlock::Create(context, "tile-cont");
+
+  llvm::Value *runs = builder.CreateICmpSLT(start, end, "tile-runs");
+  builder.CreateCondBr(runs, tileBB, afterBB);
+
+  // the tile is [first, last), with last = min(first + tile_size, end)
+  // (computed in 64 bits, so that it can't overflow)
+  builder.SetInsertPoint(tileBB);
+  llvm::Type *i32 = llvm::Type::getInt32Ty(context);
+  llvm::Type *i64 = llvm::Type::getInt64Ty(context);
+  llvm::PHINode *first = builder.CreatePHI(i32, 2, "tile-first");
+  first->addIncoming(start, preBB);
+  llvm::Value *next = builder.CreateAdd(
+      builder.CreateSExt(first, i64, "tile-first"),
+      llvm::ConstantInt::get(i64, nest[level]->tile_size), "tile-next");
+  llvm::Value *wide_end = builder.CreateSExt(end, i64, "tile-end");
+  llvm::Value *last = builder.CreateSelect(
+      builder.CreateICmpSLT(next, wide_end, "tile-full"), next, wide_end,
+      "tile-last");
+  last = builder.CreateTrunc(last, i32, "tile-last");
+
+  loop_ranges[nest[level]] = {first, last};
+  add_tile_loops(nest, bounds, level + 1);
+  loop_ranges.erase(nest[level]);
+
+  // next tile
+  llvm::Value *more = builder.CreateICmpSLT(last, end, "tile-more");
+  builder.CreateCondBr(more, tileBB, afterBB);
+  first->addIncoming(last, builder.GetInsertBlock());
+
+  afterBB->insertInto(func);
+  builder.SetInsertPoint(afterBB);
+}
+
+void CodeGenerator::add_parallel_loop(ForStatementAST &node) {
+  llvm::Function *func = builder.GetInsertBlock()->getParent();
+  llvm::Type *i32 = llvm::Type::getInt32Ty(context);
+  llvm::Type *i8_ptr = llvm::Type::getInt8PtrTy(context);
+  llvm::Value *zero = llvm::ConstantInt::get(i32, 0);
+
+  // environment: the captured locals, then the partial sums
+  std::vector<llvm::Type *> fields;
+  for (auto decl : node.captures) {
+    fields.push_back(get_llvm_type(decl->type));
+  }
+  fields.insert(fields.end(), node.reductions.size(), i32);
+  llvm::StructType *env_type = llvm::StructType::get(context, fields);
+
+  llvm::Value *start = get_return(*node.start_expr);
+  llvm::Value *end = get_return(*node.end_expr);
+
+  llvm::BasicBlock &entry = func->getEntryBlock();
+  llvm::AllocaInst *env = llvm::IRBuilder<>(&entry, entry.begin())
+                              .CreateAlloca(env_type, nullptr, "env");
+  unsigned field = 0;
+  for (auto decl : node.captures) {
+    llvm::Value *value = builder.CreateLoad(get_llvm_type(decl->type),
+                                            get_storage(decl), decl->id);
+    builder.CreateStore(value, builder.CreateStructGEP(env_type, env, field++));
+  }
+  for (unsigned i = 0; i < node.reductions.size(); i++) {
+    builder.CreateStore(zero, builder.CreateStructGEP(env_type, env, field++));
+  }
+
+  // the body, as void (i8 *env, i32 start, i32 end)
+  llvm::FunctionType *body_type = llvm::FunctionType::get(
+      llvm::Type::getVoidTy(context), {i8_ptr, i32, i32}, false);
+  llvm::Function *body = llvm::Function::Create(
+      body_type, llvm::Function::InternalLinkage, func->getName() + ".parallel",
+      module);
+  add_target_attributes(body);
+  unsigned loops = num_loops;
+  {
+    llvm::IRBuilderBase::InsertPointGuard guard(builder);
+    std::vector<llvm::AllocaInst *> outer_slots(local_slots.size(), nullptr);
+    std::swap(local_slots, outer_slots);
+    std::map<RuntimeError, ErrorBlock> outer_error_blocks;
+    std::swap(error_blocks, outer_error_blocks);
+    std::map<ArrayDeclarationAST *, llvm::Value *> outer_bases;
+    std::swap(mapped_bases, outer_bases);
+    bool outer_in_parallel_body = in_parallel_body;
+    in_parallel_body = true;
+
+    builder.SetInsertPoint(llvm::BasicBlock::Create(context, "entry", body));
+    llvm::Value *body_env = builder.CreateBitCast(
+        body->getArg(0), env_type->getPointerTo(), "env");
+    body->getArg(1)->setName("start");
+    body->getArg(2)->setName("end");
+
+    field = 0;
+    for (auto decl : node.captures) {
+      llvm::Value *value = builder.CreateLoad(
+          get_llvm_type(decl->type),
+          builder.CreateStructGEP(env_type, body_env, field++), decl->id);
+      builder.CreateStore(value, add_local(decl));
+    }
+    // (each chunk sums into its own copy of the reductions)
+    for (auto decl : node.reductions) {
+      llvm::AllocaInst *sum;
+      if (decl->is_global) {
+        sum = builder.CreateAlloca(i32, nullptr, decl->id);
+        reduction_slots[decl] = sum;
+      } else {
+        sum = add_local(decl);
+      }
+      builder.CreateStore(zero, sum);
+    }
+
+    loop_ranges[&node] = {body->getArg(1), body->getArg(2)};
+    node.accept(*this);
+    loop_ranges.erase(&node);
 
-  symbol_table.block_end(); // end for scope
+    for (auto decl : node.reductions) {
+      llvm::Value *sum = builder.CreateLoad(i32, get_storage(decl), decl->id);
+      builder.CreateAtomicRMW(
+          llvm::AtomicRMWInst::Add,
+          builder.CreateStructGEP(env_type, body_env, field++), sum,
+          llvm::MaybeAlign(), llvm::AtomicOrdering::Monotonic);
+    }
+    builder.CreateRetVoid();
+    finish_function(body);
+
+    reduction_slots.clear();
+    std::swap(local_slots, outer_slots);
+    std::swap(error_blocks, outer_error_blocks);
+    std::swap(mapped_bases, outer_bases);
+    in_parallel_body = outer_in_parallel_body;
+  }
+
+  // run it (in chunks of at least `grain` iterations, on this thread if
+  // there are too few), then add up the reductions
+  int grain = num_loops > loops + 1 ? 1 : PARALLEL_GRAIN;
+  llvm::FunctionCallee run = module->getOrInsertFunction(
+      "decaf_parallel_for", llvm::Type::getVoidTy(context),
+      body_type->getPointerTo(), i8_ptr, i32, i32, i32, i32);
+  builder.CreateCall(run, {body, builder.CreateBitCast(env, i8_ptr), start,
+                           end, llvm::ConstantInt::get(i32, options.threads),
+                           llvm::ConstantInt::get(i32, grain)});
+  num_calls++;
+
+  field = node.captures.size();
+  for (auto decl : node.reductions) {
+    llvm::Value *sum = builder.CreateLoad(
+        i32, builder.CreateStructGEP(env_type, env, field++), "partial-sum");
+    llvm::Value *var = get_storage(decl);
+    llvm::Value *value = builder.CreateLoad(i32, var, decl->id);
+    builder.CreateStore(builder.CreateAdd(value, sum, "reduce"), var);
+  }
 }
 
 void CodeGenerator::visit(AssignStatementAST &node) {
   llvm::Value *rvalue = get_return(*node.rval);
   llvm::Value *lvalue = get_return(*node.lloc);
 
+  if (packed_bit != nullptr) {
+    // (only `=`: booleans aren't added to)
+    add_packed_store(lvalue, packed_bit, rvalue);
+    packed_bit = nullptr;
+    return;
+  }
+
   if (node.op != OperatorType::ASSIGN) {
-    llvm::Value *ivalue = builder.CreateLoad(lvalue, "lvaltmp");
+    llvm::Value *ivalue = builder.CreateLoad(
+        get_llvm_type(node.lloc->expr_type), lvalue, "lvaltmp");
     if (node.op == OperatorType::ASSIGN_ADD) {
       rvalue = builder.CreateAdd(ivalue, rvalue, "plus-assign");
     } else {
@@ -482,23 +1320,17 @@ void CodeGenerator::visit(AssignStatementAST &node) {
 
 // blocks.hh
 void CodeGenerator::visit(StatementBlockAST &node) {
-  llvm::Function *func = builder.GetInsertBlock()->getParent();
-
-  symbol_table.block_start();
-
-  llvm::BasicBlock *BB = llvm::BasicBlock::Create(context, "block", func);
-  builder.CreateBr(BB); // jump to new block
-  builder.SetInsertPoint(BB);
-
+  // (emitted into the current basic block)
   for (auto decl : node.variable_declarations) {
-    (void)get_return(*decl);
+    decl->accept(*this);
   }
 
   for (auto statement : node.statements) {
-    statement->accept(*this);
+    // statements after a return/break/continue are unreachable
+    if (is_terminated())
+      break;
+    work.run(*statement, *this);
   }
-
-  symbol_table.block_end();
 }
 
 // methods.hh
@@ -516,13 +1348,27 @@ void CodeGenerator::visit(MethodDeclarationAST &node) {
 
   llvm::Function *func =
       llvm::Function::Create(func_type, linkage, node.name, module);
+  add_target_attributes(func);
+  MethodEffects effects = node.effects;
+  if (node.name == "main" && !options.mapped_arrays.empty()) {
+    // (it maps the arrays first, see add_array_mappings)
+    effects.unknown = true;
+  }
+  add_effect_attributes(func, effects);
+  method_slots[node.slot] = func;
 
   // function body
-  symbol_table.block_start();
+  local_slots.assign(node.num_locals, nullptr);
+  error_blocks.clear();
+  mapped_bases.clear();
+  in_parallel_body = node.runs_in_parallel;
 
   // generate code for body
   llvm::BasicBlock *BB = llvm::BasicBlock::Create(context, "entry", func);
   builder.SetInsertPoint(BB);
+  if (node.name == "main") {
+    add_array_mappings();
+  }
 
   {
     auto iter = node.parameters.begin();
@@ -530,58 +1376,128 @@ void CodeGenerator::visit(MethodDeclarationAST &node) {
       auto param = *iter;
 
       arg.setName(param->id);
-      llvm::Value *alloca = get_return(*param);
-      builder.CreateStore(&arg, alloca);
+      builder.CreateStore(&arg, add_local(param));
 
       iter++;
     }
   }
+  // (self tail calls jump back here)
+  body_block = llvm::BasicBlock::Create(context, "body", func);
+  builder.CreateBr(body_block);
+  builder.SetInsertPoint(body_block);
 
   node.body->accept(*this);
 
-  if (node.return_type == ValueType::VOID) {
+  if (is_terminated()) {
+    // (the body ends with a return)
+  } else if (node.return_type == ValueType::VOID) {
     // create a return at the end of void function, to avoid IR error
     builder.CreateRetVoid();
   } else {
     // TODO: check for missing return in semantic analysis
-    add_runtime_error_inst(2, "Control reaches end of function `" + node.name +
-                                  "`");
+    builder.CreateCall(get_error_function(RuntimeError::MISSING_RETURN),
+                       {get_string("`" + node.name + "`"),
+                        get_string(node.location)});
+    builder.CreateUnreachable();
   }
 
-  symbol_table.block_end();
+  finish_function(func);
+}
 
+void CodeGenerator::finish_function(llvm::Function *func) {
   if (llvm::verifyFunction(*func)) {
     has_error = true;
+    return;
+  }
+
+  if (options.promote_locals) {
+    std::vector<llvm::AllocaInst *> allocas;
+    for (auto alloca : local_slots) {
+      if (alloca && llvm::isAllocaPromotable(alloca)) {
+        allocas.push_back(alloca);
+      }
+    }
+    llvm::DominatorTree dominators(*func);
+    llvm::PromoteMemToReg(allocas, dominators);
   }
 }
 
 void CodeGenerator::visit(MethodCallAST &node) {
-  std::vector<llvm::Value *> args;
-  for (auto arg : node.arguments) {
-    args.push_back(get_return(*arg));
+  if (work.stage() == 0) {
+    work.defer(node, 1, node.arguments);
+    return;
+  }
+
+  add_call(node, method_slots[node.decl->slot], get_arguments(node));
+}
+
+std::vector<llvm::Value *> CodeGenerator::get_arguments(MethodCallAST &node) {
+  std::vector<llvm::Value *> args(node.arguments.size());
+  for (auto it = args.rbegin(); it != args.rend(); it++) {
+    *it = get_return_stack_top();
   }
-  llvm::Function *func = module->getFunction(node.id);
+  return args;
+}
 
-  if (func->getReturnType() ==
-      llvm::Type::getVoidTy(context)) { // void function
+void CodeGenerator::add_call(MethodCallAST &node, llvm::Function *func,
+                             const std::vector<llvm::Value *> &args) {
+  num_calls++;
+  if (node.expr_type == ValueType::VOID) {
     builder.CreateCall(func, args);
   } else {
-    auto ret = builder.CreateCall(func, args, "fcall");
-    return_stack.push(ret);
+    push_value(node, builder.CreateCall(func, args, "fcall"));
   }
 }
 
 void CodeGenerator::visit(CalloutCallAST &node) {
-  add_builtin(node.id, node.arg_types, ValueType::INT);
-  MethodCallAST *p = dynamic_cast<MethodCallAST *>(&node);
-  visit(*p);
+  if (work.stage() == 0) {
+    work.defer(node, 1, node.arguments);
+    return;
+  }
+
+  std::vector<llvm::Value *> args = get_arguments(node);
+
+  // bulk array I/O: a single check that elements [0, n) are in bounds
+  // (instead of one per element)
+  auto array = node.arguments.empty()
+                   ? nullptr
+                   : dynamic_cast<ArrayAddressAST *>(node.arguments[0]);
+  if ((node.id == "read_int_array" || node.id == "write_int_array") &&
+      array != nullptr && args.size() >= 2 &&
+      node.arg_types[1] == ValueType::INT) {
+    auto decl = static_cast<ArrayDeclarationAST *>(array->decl);
+    auto mapping = options.mapped_arrays.find(decl->id);
+    if (node.id == "read_int_array" && mapping != options.mapped_arrays.end() &&
+        !mapping->second.writable) {
+      error("Error: --map-ro: array `%s` is read into [%s]", decl->id.c_str(),
+            node.location.c_str());
+      has_error = true;
+    }
+    if (options.bounds != Options::BoundsChecks::OFF) {
+      add_count_check(args[1], decl, node.location);
+    }
+  }
+
+  add_call(node, add_builtin(node.id, node.arg_types, ValueType::INT), args);
 }
 
 // program.hh
 void CodeGenerator::visit(ProgramAST &node) {
+  global_slots.resize(node.global_variables.size());
+  method_slots.resize(node.methods.size());
+
   for (auto decl : node.global_variables) {
     decl->accept(*this);
   }
+  for (auto &mapping : options.mapped_arrays) {
+    auto is_array = [&](ArrayDeclarationAST *decl) {
+      return decl->id == mapping.first;
+    };
+    if (std::none_of(mapped_arrays.begin(), mapped_arrays.end(), is_array)) {
+      error("Error: --map: no global array `%s`", mapping.first.c_str());
+      has_error = true;
+    }
+  }
 
   for (auto method : node.methods) {
     method->accept(*this);
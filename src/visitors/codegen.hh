@@ -13,13 +13,51 @@
 #include <llvm/Support/TargetSelect.h>
 
 #include "visitor.hh"
+#include "work_stack.hh"
 
 class CodeGenerator : public ASTvisitor {
 public:
-  CodeGenerator(std::string name);
+  struct Options {
+    // array bounds checks: on every access (except the ones proven safe),
+    // hoisted out of loops where possible (see RangeAnalyzer), or none
+    enum class BoundsChecks { FULL, HOISTED, OFF } bounds;
+    // promote local variables to registers (mem2reg), even in unoptimized
+    // builds
+    bool promote_locals;
+    // CPU and features to generate code for ("native" for the host), set on
+    // every function (none by default)
+    std::string target_cpu, target_features;
+    // ask LLVM to vectorize innermost loops without calls
+    // (llvm.loop.vectorize.enable)
+    bool vectorize;
+    // store boolean arrays as bitsets (64 elements per i64 word) instead of
+    // a byte per element
+    bool pack_bools;
+    // threads to run parallel loops on (0: one per core)
+    unsigned threads;
+    // global int arrays backed by files, mapped at the start of main (see
+    // builtins/mapped_arrays.cc), by name: the file, and whether the array
+    // is copy-on-write (or read-only)
+    struct MappedArray {
+      std::string path;
+      bool writable;
+    };
+    std::map<std::string, MappedArray> mapped_arrays;
+    // LLVM bitcode of the builtins (build/builtins.bc) to link into the
+    // module, internalized so that they can be inlined (and dropped if
+    // unused); none by default (the program is linked with builtins.o)
+    std::string runtime;
+
+    Options()
+        : bounds(BoundsChecks::FULL), promote_locals(false), vectorize(false),
+          pack_bools(false), threads(0) {}
+  };
+
+  CodeGenerator(std::string name, Options _options = Options());
   virtual ~CodeGenerator();
 
-  void generate(BaseAST &root);
+  // returns false on errors
+  bool generate(BaseAST &root);
   void print(std::string outf);
 
 private:
@@ -28,36 +66,152 @@ private:
   llvm::Module *module;
   llvm::IRBuilder<> builder;
   bool has_error;
+  Options options;
 
-  // symbol table
-  class SymbolTable {
-    std::vector<std::map<std::string, llvm::AllocaInst *>> variables;
-    std::map<std::string, int> array_lengths;
-
-  public:
-    void block_start();
-    void block_end();
-    void add_variable(std::string id, llvm::AllocaInst *alloca);
-    llvm::AllocaInst *lookup_variable(std::string id);
-
-    void add_array(std::string id, int length);
-    int get_array_len(std::string id);
+  // set the target triple and data layout of the module (for the host), and
+  // resolve options.target_cpu/target_features
+  void set_target();
+  // target-cpu/target-features attributes of `func`, if set
+  void add_target_attributes(llvm::Function *func);
+  // attributes of the function of a method, from its effects
+  void add_effect_attributes(llvm::Function *func,
+                             const MethodEffects &effects);
+  // link options.runtime into the module, returns false on errors
+  bool link_runtime();
+  // Data layout of the program's globals: scalars first, hottest first (by
+  // their accesses, weighted by loop depth), starting a cache line, then the
+  // arrays, each starting a cache line (or a huge page, if that large), so
+  // that no array shares a line with the scalars or another array.
+  void layout_globals();
+  static const unsigned CACHE_LINE = 64, HUGE_PAGE = 2 << 20;
+  // (an access in a loop counts as this many outside it)
+  static constexpr double LOOP_WEIGHT = 8;
 
-    bool is_global_scope();
-  } symbol_table;
+  // storage of declarations, indexed by the slots assigned in semantic
+  // analysis (globals, locals of the current method, methods)
+  std::vector<llvm::GlobalVariable *> global_slots;
+  std::vector<llvm::AllocaInst *> local_slots;
+  std::vector<llvm::Function *> method_slots;
+  llvm::Value *get_storage(VariableDeclarationAST *decl);
+  llvm::ArrayType *get_array_type(ArrayDeclarationAST *decl);
+  // packed boolean arrays (options.pack_bools): element i is bit i % 64 of
+  // word i / 64
+  bool is_packed(ArrayDeclarationAST *decl);
+  // bit of the packed element being assigned, if the current lvalue is one
+  // (its word is on the return stack), else nullptr
+  llvm::Value *packed_bit;
+  // whether code is generated for the body of a parallel loop, or a method
+  // called from one (where words of packed arrays are updated atomically:
+  // other threads may update other bits of them)
+  bool in_parallel_body;
+  // store `value` (an i1) as bit `bit` of the word at `word_ptr`
+  void add_packed_store(llvm::Value *word_ptr, llvm::Value *bit,
+                        llvm::Value *value);
+  // the address of a global array: its global variable, or for a mapped
+  // one (options.mapped_arrays), the address stored in it at the start of
+  // main, loaded once per function
+  llvm::Value *get_array(ArrayDeclarationAST *decl);
+  std::vector<ArrayDeclarationAST *> mapped_arrays;
+  std::map<ArrayDeclarationAST *, llvm::Value *> mapped_bases;
+  // map the files of the mapped arrays (in main)
+  void add_array_mappings();
+  // allocate a local in the entry block of the current method (whatever
+  // block it is declared in), so that it can be promoted to a register
+  llvm::AllocaInst *add_local(VariableDeclarationAST *decl);
+  // verify a generated function, and promote its locals (if asked to)
+  void finish_function(llvm::Function *func);
 
   std::stack<llvm::Value *> return_stack;
+  // push the value of expression `node`, of type node.expr_type
+  void push_value(BaseAST &node, llvm::Value *value);
   llvm::Value *get_return_stack_top(bool pop = true);
   llvm::Value *get_return(BaseAST &node);
 
+  WorkStack work;
+
   // jump blocks inside for: <increment-block, after-block>
   std::stack<std::pair<llvm::BasicBlock *, llvm::BasicBlock *>> for_jump_blocks;
+  // tiled loop nests (see LoopNestOptimizer): loops over the tiles of each
+  // loop in the nest, around the loops of the nest (over the current tiles)
+  void add_tiled_nest(ForStatementAST &root);
+  void add_tile_loops(
+      std::vector<ForStatementAST *> &nest,
+      std::vector<std::pair<llvm::Value *, llvm::Value *>> &bounds,
+      unsigned level);
+  // parallel loops (see DependenceAnalyzer): the body is outlined to a
+  // function running a chunk of the iterations, called by the thread pool
+  // (decaf_parallel_for, in builtins), with the captured locals and the
+  // partial sums of the reductions in an environment struct
+  void add_parallel_loop(ForStatementAST &node);
+  // iterations per chunk, at least (unless the body has loops)
+  static const int PARALLEL_GRAIN = 1024;
+  // private copies of the global reductions, in the outlined body
+  std::map<VariableDeclarationAST *, llvm::AllocaInst *> reduction_slots;
+  // ranges to run loops over, instead of their bounds: the current tile of
+  // the loops of a tiled nest, or the chunk of an outlined parallel loop
+  std::map<ForStatementAST *, std::pair<llvm::Value *, llvm::Value *>>
+      loop_ranges;
+  // loops and calls generated so far (to tell if a loop body has any), and
+  // loops whose iterator is assigned in them (which may not terminate)
+  unsigned num_loops, num_calls, num_unbounded_loops;
+  // llvm.loop metadata for the latch of a loop: mustprogress if it is
+  // `finite`, and a vectorization hint if `vectorizable` (nullptr if none)
+  llvm::MDNode *get_loop_metadata(bool finite, bool vectorizable);
+  // blocks of the && / || being evaluated: <end of left operand, after-block>
+  std::stack<std::pair<llvm::BasicBlock *, llvm::BasicBlock *>>
+      short_circuit_blocks;
+
+  // Tail calls (`return f(...)`): a call to the method itself stores the
+  // arguments in its parameters, and jumps back to the start of its body
+  // (so deep recursion runs in constant stack space); a call to another
+  // method of the same type is `musttail`.
+  llvm::BasicBlock *body_block;
+  // generate `return call`, if it is such a tail call (otherwise false)
+  bool add_tail_call(MethodCallAST &call);
 
   llvm::Type *get_llvm_type(ValueType ty);
-  void add_builtin(std::string name, std::vector<ValueType> _params,
-                   ValueType ret);
+  llvm::Function *add_builtin(std::string name, std::vector<ValueType> _params,
+                              ValueType ret);
+  // pop the values of the arguments of a call
+  std::vector<llvm::Value *> get_arguments(MethodCallAST &node);
+  void add_call(MethodCallAST &node, llvm::Function *func,
+                const std::vector<llvm::Value *> &args);
+
+  // string constants, deduplicated
+  std::map<std::string, llvm::Constant *> strings;
+  llvm::Constant *get_string(const std::string &str);
 
-  void add_runtime_error_inst(int ec, std::string err);
+  // Runtime errors: each kind is reported by an outlined (cold, noreturn)
+  // function, taking the name of the failing array/method and the location.
+  // Within a method, all the checks of a kind branch to a single block
+  // calling it.
+  enum class RuntimeError { ARRAY_BOUNDS, MISSING_RETURN };
+  std::map<RuntimeError, llvm::Function *> error_functions;
+  llvm::Function *get_error_function(RuntimeError kind);
+  struct ErrorBlock {
+    llvm::BasicBlock *block;
+    llvm::PHINode *name, *location;
+  };
+  std::map<RuntimeError, ErrorBlock> error_blocks;
+  // branch weights of checks (as for llvm.expect)
+  static const uint32_t LIKELY_WEIGHT = 2000, UNLIKELY_WEIGHT = 1;
+  // continue if `cond` holds, otherwise report the error
+  void add_runtime_check(llvm::Value *cond, RuntimeError kind,
+                         const std::string &name, const std::string &location);
+  // exit with an error unless 0 <= index < length of the array
+  void add_bounds_check(llvm::Value *index, ArrayDeclarationAST *decl,
+                        const std::string &location);
+  // exit with an error unless 0 <= count <= length of the array (elements
+  // [0, count) are accessed)
+  void add_count_check(llvm::Value *count, ArrayDeclarationAST *decl,
+                       const std::string &location);
+  // check the accesses in node.hoisted_checks for the first and last value
+  // of the iterator (in the preheader of the loop, which runs at least once)
+  void add_hoisted_checks(ForStatementAST &node, llvm::Value *start,
+                          llvm::Value *end);
+  // whether the current block already ends with a branch/return (anything
+  // emitted after it would be unreachable)
+  bool is_terminated();
   void error(const std::string &fmt, ...);
 
 public:
@@ -0,0 +1,413 @@
+#include <climits>
+
+#include "../ast/ast.hh"
+#include "../ast/blocks.hh"
+#include "../ast/literals.hh"
+#include "../ast/methods.hh"
+#include "../ast/operators.hh"
+#include "../ast/program.hh"
+#include "../ast/statements.hh"
+#include "../ast/variables.hh"
+#include "../exceptions.hh"
+#include "constant_folder.hh"
+
+// value of an int/boolean literal, returns false for any other node
+static bool get_literal(BaseAST *node, int &value) {
+  if (auto literal = dynamic_cast<IntegerLiteralAST *>(node)) {
+    value = literal->value;
+    return true;
+  }
+  if (auto literal = dynamic_cast<BooleanLiteralAST *>(node)) {
+    value = literal->value;
+    return true;
+  }
+  return false;
+}
+
+void ConstantFolder::optimize(BaseAST &root) {
+  long live_nodes = BaseAST::live_nodes;
+  root.accept(*this);
+  removed = live_nodes - BaseAST::live_nodes;
+}
+
+void ConstantFolder::display_stats(std::ostream &out) {
+  out << "constant folding: removed " << removed << " AST nodes (" << folded
+      << " folded operators, " << propagated << " propagated constants, "
+      << pruned << " pruned branches)\n";
+}
+
+void ConstantFolder::take(BaseAST *&node) {
+  BaseAST *res = results.top();
+  results.pop();
+  if (res != node) {
+    BaseAST::release(node);
+    node = res;
+  }
+}
+
+void ConstantFolder::fold(BaseAST *&node) {
+  work.run(*node, *this);
+  take(node);
+}
+
+void ConstantFolder::push_literal(BaseAST &node, int value) {
+  LiteralAST *literal;
+  if (node.expr_type == ValueType::BOOL) {
+    literal = new BooleanLiteralAST(value != 0);
+  } else {
+    literal = new IntegerLiteralAST(value);
+  }
+  literal->set_location(node.location);
+  results.push(literal);
+}
+
+bool ConstantFolder::find_constants(StatementBlockAST *block) {
+  for (auto &stmt : block->statements) {
+    // descend into methods called only from here
+    auto call = dynamic_cast<MethodCallAST *>(stmt);
+    if (call && call->decl && call->decl->call_count == 1 &&
+        call->decl->name != "main") {
+      for (auto &arg : call->arguments) {
+        fold(arg);
+      }
+      if (calls > 0 || !find_constants(call->decl->body))
+        return false;
+      continue;
+    }
+
+    fold(stmt);
+    if (calls > 0 || returned)
+      return false;
+
+    auto assign = dynamic_cast<AssignStatementAST *>(stmt);
+    if (assign && assign->op == OperatorType::ASSIGN &&
+        dynamic_cast<VariableLocationAST *>(assign->lloc)) {
+      auto decl = assign->lloc->decl;
+      int value;
+      if (decl->is_global && decl->assign_count == 1 && !reads.count(decl) &&
+          get_literal(assign->rval, value)) {
+        constants[decl] = value;
+      }
+    }
+  }
+  return true;
+}
+
+// Visit functions
+void ConstantFolder::visit(BaseAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+
+// literals.hh
+void ConstantFolder::visit(LiteralAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+void ConstantFolder::visit(IntegerLiteralAST &node) { results.push(&node); }
+void ConstantFolder::visit(BooleanLiteralAST &node) { results.push(&node); }
+void ConstantFolder::visit(StringLiteralAST &node) { results.push(&node); }
+
+// variables.hh
+void ConstantFolder::visit(LocationAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+void ConstantFolder::visit(VariableLocationAST &node) {
+  if (!node.is_lvalue) {
+    auto it = constants.find(node.decl);
+    if (it != constants.end()) {
+      propagated++;
+      push_literal(node, it->second);
+      return;
+    }
+    if (tracking) {
+      reads.insert(node.decl);
+    }
+  }
+  results.push(&node);
+}
+void ConstantFolder::visit(ArrayLocationAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.index_expr});
+    return;
+  }
+
+  take(node.index_expr);
+  results.push(&node);
+}
+void ConstantFolder::visit(ArrayAddressAST &node) { results.push(&node); }
+void ConstantFolder::visit(VariableDeclarationAST &node) {}
+void ConstantFolder::visit(ArrayDeclarationAST &node) {}
+
+// operators.hh
+void ConstantFolder::visit(UnaryOperatorAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+void ConstantFolder::visit(BinaryOperatorAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+
+void ConstantFolder::visit(ArithBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  take(node.rval);
+  take(node.lval);
+
+  int l, r;
+  if (!get_literal(node.lval, l) || !get_literal(node.rval, r)) {
+    results.push(&node);
+    return;
+  }
+
+  // 32-bit two's complement, like the generated code
+  unsigned ul = l, ur = r;
+  int value;
+  if (node.op == OperatorType::ADD) {
+    value = ul + ur;
+  } else if (node.op == OperatorType::SUB) {
+    value = ul - ur;
+  } else if (node.op == OperatorType::MUL) {
+    value = ul * ur;
+  } else {
+    // division by zero (or overflow) is left to the runtime
+    if (r == 0 || (l == INT_MIN && r == -1)) {
+      results.push(&node);
+      return;
+    }
+    value = node.op == OperatorType::DIV ? l / r : l % r;
+  }
+
+  folded++;
+  push_literal(node, value);
+}
+
+void ConstantFolder::visit(CondBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  take(node.rval);
+  take(node.lval);
+
+  int l, r;
+  if (!get_literal(node.lval, l) || !get_literal(node.rval, r)) {
+    results.push(&node);
+    return;
+  }
+
+  folded++;
+  push_literal(node, node.op == OperatorType::AND ? (l && r) : (l || r));
+}
+
+void ConstantFolder::visit(RelBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  take(node.rval);
+  take(node.lval);
+
+  int l, r;
+  if (!get_literal(node.lval, l) || !get_literal(node.rval, r)) {
+    results.push(&node);
+    return;
+  }
+
+  bool value;
+  if (node.op == OperatorType::LE) {
+    value = l <= r;
+  } else if (node.op == OperatorType::LT) {
+    value = l < r;
+  } else if (node.op == OperatorType::GE) {
+    value = l >= r;
+  } else {
+    value = l > r;
+  }
+
+  folded++;
+  push_literal(node, value);
+}
+
+void ConstantFolder::visit(EqBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  take(node.rval);
+  take(node.lval);
+
+  int l, r;
+  if (!get_literal(node.lval, l) || !get_literal(node.rval, r)) {
+    results.push(&node);
+    return;
+  }
+
+  folded++;
+  push_literal(node, node.op == OperatorType::EQ ? l == r : l != r);
+}
+
+void ConstantFolder::visit(UnaryMinusAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.val});
+    return;
+  }
+
+  take(node.val);
+
+  int value;
+  if (!get_literal(node.val, value)) {
+    results.push(&node);
+    return;
+  }
+
+  folded++;
+  push_literal(node, 0u - (unsigned)value);
+}
+
+void ConstantFolder::visit(UnaryNotAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.val});
+    return;
+  }
+
+  take(node.val);
+
+  int value;
+  if (!get_literal(node.val, value)) {
+    results.push(&node);
+    return;
+  }
+
+  folded++;
+  push_literal(node, !value);
+}
+
+// statements.hh
+void ConstantFolder::visit(ReturnStatementAST &node) {
+  if (node.ret_expr) {
+    fold(node.ret_expr);
+  }
+  if (tracking) {
+    returned = true;
+  }
+  results.push(&node);
+}
+
+void ConstantFolder::visit(BreakStatementAST &node) { results.push(&node); }
+
+void ConstantFolder::visit(ContinueStatementAST &node) { results.push(&node); }
+
+void ConstantFolder::visit(IfStatementAST &node) {
+  fold(node.cond_expr);
+
+  int cond;
+  if (!get_literal(node.cond_expr, cond)) {
+    fold(node.then_block);
+    if (node.else_block) {
+      fold(node.else_block);
+    }
+    results.push(&node);
+    return;
+  }
+
+  // replace the statement with the branch taken (if any)
+  pruned++;
+  BaseAST *&taken = cond ? node.then_block : node.else_block;
+  if (taken) {
+    fold(taken);
+  }
+  results.push(taken);
+  taken = nullptr;
+}
+
+void ConstantFolder::visit(ForStatementAST &node) {
+  fold(node.start_expr);
+  fold(node.end_expr);
+  fold(node.block);
+  results.push(&node);
+}
+
+void ConstantFolder::visit(AssignStatementAST &node) {
+  if (node.lloc->index_expr) {
+    fold(node.lloc->index_expr);
+  }
+  fold(node.rval);
+  results.push(&node);
+}
+
+// blocks.hh
+void ConstantFolder::visit(StatementBlockAST &node) {
+  // statements pruned by find_constants are already null
+  unsigned count = 0;
+  for (auto stmt : node.statements) {
+    if (stmt) {
+      fold(stmt);
+    }
+    if (stmt) {
+      node.statements[count++] = stmt;
+    }
+  }
+  node.statements.resize(count);
+
+  results.push(&node);
+}
+
+// methods.hh
+void ConstantFolder::visit(MethodDeclarationAST &node) {
+  node.body->accept(*this);
+  results.pop();
+}
+
+void ConstantFolder::visit(MethodCallAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, node.arguments);
+    return;
+  }
+
+  for (auto it = node.arguments.rbegin(); it != node.arguments.rend(); it++) {
+    take(*it);
+  }
+  if (tracking) {
+    calls++;
+  }
+  results.push(&node);
+}
+
+void ConstantFolder::visit(CalloutCallAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, node.arguments);
+    return;
+  }
+
+  // (callouts can't access globals)
+  for (auto it = node.arguments.rbegin(); it != node.arguments.rend(); it++) {
+    take(*it);
+  }
+  results.push(&node);
+}
+
+// program.hh
+void ConstantFolder::visit(ProgramAST &node) {
+  // globals that are never assigned keep their zero value
+  for (auto decl : node.global_variables) {
+    if (!dynamic_cast<ArrayDeclarationAST *>(decl) && decl->assign_count == 0) {
+      constants[decl] = 0;
+    }
+  }
+
+  for (auto method : node.methods) {
+    if (method->name == "main") {
+      tracking = true;
+      find_constants(method->body);
+      tracking = false;
+    }
+  }
+
+  for (auto method : node.methods) {
+    method->accept(*this);
+  }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <map>
+#include <ostream>
+#include <set>
+#include <stack>
+#include <string>
+
+#include "visitor.hh"
+#include "work_stack.hh"
+
+// Constant folding and propagation, run on a checked AST before codegen.
+//
+// Folds operators over literals, replaces reads of globals that are never
+// assigned (zero) or assigned a constant once before they can be read, and
+// prunes if statements with constant conditions.
+class ConstantFolder : public ASTvisitor {
+public:
+  ConstantFolder()
+      : tracking(false), calls(0), returned(false), folded(0), propagated(0),
+        pruned(0), removed(0) {}
+  virtual ~ConstantFolder() = default;
+
+  void optimize(BaseAST &root);
+  void display_stats(std::ostream &out);
+
+private:
+  WorkStack work;
+
+  // node replacing each visited node (itself if unchanged, nullptr for a
+  // removed statement)
+  std::stack<BaseAST *> results;
+  // replace `node` with the top result, releasing it if it changed
+  void take(BaseAST *&node);
+  // visit `node`, and replace it with the result
+  void fold(BaseAST *&node);
+  // push a literal with `value`, replacing the expression `node`
+  void push_literal(BaseAST &node, int value);
+
+  // values of constant globals (0/1 for booleans)
+  std::map<VariableDeclarationAST *, int> constants;
+
+  // finds globals assigned a constant exactly once, before any read: walks
+  // the statements of `block` executed unconditionally from the start of
+  // main, returns false once that can no longer be shown
+  bool find_constants(StatementBlockAST *block);
+  // effects of the statements folded while tracking
+  bool tracking;
+  std::set<VariableDeclarationAST *> reads;
+  int calls;
+  bool returned;
+
+  // statistics
+  int folded, propagated, pruned;
+  long removed;
+
+public:
+  // visits:
+  virtual void visit(BaseAST &node);
+
+  // literals.hh
+  virtual void visit(LiteralAST &node);
+  virtual void visit(IntegerLiteralAST &node);
+  virtual void visit(BooleanLiteralAST &node);
+  virtual void visit(StringLiteralAST &node);
+
+  // variables.hh
+  virtual void visit(LocationAST &node);
+  virtual void visit(VariableLocationAST &node);
+  virtual void visit(ArrayLocationAST &node);
+  virtual void visit(ArrayAddressAST &node);
+  virtual void visit(VariableDeclarationAST &node);
+  virtual void visit(ArrayDeclarationAST &node);
+
+  // operators.hh
+  virtual void visit(UnaryOperatorAST &node);
+  virtual void visit(BinaryOperatorAST &node);
+  virtual void visit(ArithBinOperatorAST &node);
+  virtual void visit(CondBinOperatorAST &node);
+  virtual void visit(RelBinOperatorAST &node);
+  virtual void visit(EqBinOperatorAST &node);
+  virtual void visit(UnaryMinusAST &node);
+  virtual void visit(UnaryNotAST &node);
+
+  // statements.hh
+  virtual void visit(ReturnStatementAST &node);
+  virtual void visit(BreakStatementAST &node);
+  virtual void visit(ContinueStatementAST &node);
+  virtual void visit(IfStatementAST &node);
+  virtual void visit(ForStatementAST &node);
+  virtual void visit(AssignStatementAST &node);
+
+  // blocks.hh
+  virtual void visit(StatementBlockAST &node);
+
+  // methods.hh
+  virtual void visit(MethodDeclarationAST &node);
+  virtual void visit(MethodCallAST &node);
+  virtual void visit(CalloutCallAST &node);
+
+  // program.hh
+  virtual void visit(ProgramAST &node);
+};
@@ -0,0 +1,499 @@
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <utility>
+
+#include "../ast/ast.hh"
+#include "../ast/blocks.hh"
+#include "../ast/literals.hh"
+#include "../ast/methods.hh"
+#include "../ast/operators.hh"
+#include "../ast/program.hh"
+#include "../ast/statements.hh"
+#include "../ast/variables.hh"
+#include "../exceptions.hh"
+#include "dependence_analyzer.hh"
+
+// (bigger polynomials are given up on)
+static const unsigned MAX_TERMS = 32;
+
+// value of a constant polynomial, returns false for any other one
+static bool get_constant(
+    const std::map<std::vector<VariableDeclarationAST *>, long long> &terms,
+    long long &value) {
+  if (terms.empty()) {
+    value = 0;
+    return true;
+  }
+  if (terms.size() == 1 && terms.begin()->first.empty()) {
+    value = terms.begin()->second;
+    return true;
+  }
+  return false;
+}
+
+void DependenceAnalyzer::analyze(BaseAST &root) { root.accept(*this); }
+
+void DependenceAnalyzer::display_stats(std::ostream &out) {
+  out << "dependence analysis: " << parallel << " of " << loops
+      << " for loops parallel\n";
+}
+
+DependenceAnalyzer::Polynomial DependenceAnalyzer::constant(long long value) {
+  Polynomial res{true, {}};
+  if (value != 0) {
+    res.terms[std::vector<VariableDeclarationAST *>()] = value;
+  }
+  return res;
+}
+DependenceAnalyzer::Polynomial
+DependenceAnalyzer::variable(VariableDeclarationAST *decl) {
+  return {true, {{{decl}, 1}}};
+}
+DependenceAnalyzer::Polynomial DependenceAnalyzer::invalid() {
+  return {false, {}};
+}
+
+DependenceAnalyzer::Polynomial DependenceAnalyzer::add(const Polynomial &a,
+                                                       const Polynomial &b,
+                                                       int sign) {
+  if (!a.valid || !b.valid)
+    return invalid();
+
+  Polynomial res = a;
+  for (auto &term : b.terms) {
+    long long coefficient = res.terms[term.first] + sign * term.second;
+    if (coefficient < INT_MIN || coefficient > INT_MAX)
+      return invalid();
+    if (coefficient == 0) {
+      res.terms.erase(term.first);
+    } else {
+      res.terms[term.first] = coefficient;
+    }
+  }
+  return res;
+}
+
+DependenceAnalyzer::Polynomial
+DependenceAnalyzer::multiply(const Polynomial &a, const Polynomial &b) {
+  if (!a.valid || !b.valid)
+    return invalid();
+
+  Polynomial res = constant(0);
+  for (auto &x : a.terms) {
+    for (auto &y : b.terms) {
+      std::vector<VariableDeclarationAST *> monomial = x.first;
+      monomial.insert(monomial.end(), y.first.begin(), y.first.end());
+      std::sort(monomial.begin(), monomial.end());
+
+      long long coefficient = x.second * y.second;
+      if (coefficient < INT_MIN || coefficient > INT_MAX)
+        return invalid();
+      res = add(res, Polynomial{true, {{monomial, coefficient}}}, 1);
+      if (!res.valid || res.terms.size() > MAX_TERMS)
+        return invalid();
+    }
+  }
+  return res;
+}
+
+DependenceAnalyzer::Polynomial DependenceAnalyzer::get_top_value() {
+  Polynomial res = values.top();
+  values.pop();
+  return res;
+}
+DependenceAnalyzer::Polynomial DependenceAnalyzer::get_value(BaseAST &expr) {
+  work.run(expr, *this);
+  return get_top_value();
+}
+
+bool DependenceAnalyzer::is_affine_index(const Polynomial &value,
+                                         ForStatementAST &node) {
+  if (!value.valid)
+    return false;
+  for (auto &term : value.terms) {
+    for (auto var : term.first) {
+      if (var == node.iterator)
+        continue;
+      if (body.loops.count(var)) {
+        if (var->assign_count > 0)
+          return false;
+        continue;
+      }
+      if (body.declared.count(var) || body.written.count(var))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool DependenceAnalyzer::is_disjoint(const Polynomial &index,
+                                     ForStatementAST &node) {
+  // index = i * P + R
+  Polynomial step = constant(0), rest = constant(0);
+  for (auto &term : index.terms) {
+    std::vector<VariableDeclarationAST *> monomial = term.first;
+    auto it = std::find(monomial.begin(), monomial.end(), node.iterator);
+    if (it == monomial.end()) {
+      rest.terms[monomial] = term.second;
+      continue;
+    }
+    monomial.erase(it);
+    if (std::count(monomial.begin(), monomial.end(), node.iterator))
+      return false;
+    step.terms[monomial] = term.second;
+  }
+  if (step.terms.empty())
+    return false;
+
+  // (P doesn't depend on the nested loops)
+  for (auto &term : step.terms) {
+    for (auto var : term.first) {
+      if (body.loops.count(var))
+        return false;
+    }
+  }
+  // the nested loop iterators in R (only as k * j), and their coefficients
+  std::vector<std::pair<InnerLoop *, long long>> inner;
+  for (auto &term : rest.terms) {
+    for (auto var : term.first) {
+      if (!body.loops.count(var))
+        continue;
+      if (term.first.size() != 1)
+        return false;
+      inner.emplace_back(&body.loops[var], term.second);
+    }
+  }
+
+  long long value;
+  if (get_constant(step.terms, value)) {
+    // R varies by less than |P| within an iteration
+    long long spread = 0;
+    for (auto &loop : inner) {
+      long long start, end;
+      if (!get_constant(loop.first->start.terms, start) ||
+          !get_constant(loop.first->end.terms, end))
+        return false;
+      if (start < end) {
+        spread += std::llabs(loop.second) * (end - 1 - start);
+      }
+    }
+    return spread < std::llabs(value);
+  }
+
+  // R = j + b, with j in [0, P) (no accesses if P <= 0)
+  if (inner.size() != 1 || inner[0].second != 1)
+    return false;
+  InnerLoop *loop = inner[0].first;
+  return loop->start.valid && loop->start.terms.empty() && loop->end.valid &&
+         loop->end.terms == step.terms;
+}
+
+bool DependenceAnalyzer::analyze_loop(ForStatementAST &node) {
+  // (tiled loops are generated as they are)
+  if (node.tile_size > 0 || node.iterator->assign_count > 0)
+    return false;
+
+  body = Body{{}, {}, {}, {}, {}, false, false, false, 0};
+  collecting = true;
+  node.block->accept(*this);
+  collecting = false;
+  if (body.has_call || body.has_return || body.has_jump)
+    return false;
+
+  // scalars: the body's own, or reductions
+  std::vector<VariableDeclarationAST *> reductions;
+  for (auto &var : body.written) {
+    if (body.declared.count(var.first))
+      continue;
+    if (!var.second || var.first->type != ValueType::INT ||
+        body.read.count(var.first))
+      return false;
+    reductions.push_back(var.first);
+  }
+
+  // arrays: every access to a written array is at the same index, which
+  // differs between iterations
+  std::map<VariableDeclarationAST *, Polynomial *> indices;
+  for (auto &access : body.accesses) {
+    if (access.write) {
+      indices.emplace(access.array, &access.index);
+    }
+  }
+  for (auto &access : body.accesses) {
+    auto it = indices.find(access.array);
+    if (it != indices.end() &&
+        (!access.index.valid || access.index.terms != it->second->terms))
+      return false;
+  }
+  for (auto &array : indices) {
+    if (!is_affine_index(*array.second, node) ||
+        !is_disjoint(*array.second, node))
+      return false;
+  }
+
+  node.parallel = true;
+  node.reductions = reductions;
+  node.captures.clear();
+  for (auto var : body.read) {
+    if (!var->is_global && var != node.iterator && !body.declared.count(var)) {
+      node.captures.push_back(var);
+    }
+  }
+  // (in declaration order, so that the generated code is deterministic)
+  for (auto vars : {&node.captures, &node.reductions}) {
+    std::sort(vars->begin(), vars->end(),
+              [](VariableDeclarationAST *a, VariableDeclarationAST *b) {
+                return std::make_pair(a->is_global, a->slot) <
+                       std::make_pair(b->is_global, b->slot);
+              });
+  }
+  parallel++;
+  return true;
+}
+
+// Visit functions
+void DependenceAnalyzer::visit(BaseAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+
+// literals.hh
+void DependenceAnalyzer::visit(LiteralAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+void DependenceAnalyzer::visit(IntegerLiteralAST &node) {
+  values.push(constant(node.value));
+}
+void DependenceAnalyzer::visit(BooleanLiteralAST &node) {
+  values.push(invalid());
+}
+void DependenceAnalyzer::visit(StringLiteralAST &node) {
+  values.push(invalid());
+}
+
+// variables.hh
+void DependenceAnalyzer::visit(LocationAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+void DependenceAnalyzer::visit(VariableLocationAST &node) {
+  if (collecting && !node.is_lvalue) {
+    body.read.insert(node.decl);
+  }
+  if (node.expr_type == ValueType::INT) {
+    values.push(variable(node.decl));
+  } else {
+    values.push(invalid());
+  }
+}
+void DependenceAnalyzer::visit(ArrayLocationAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.index_expr});
+    return;
+  }
+
+  Polynomial index = get_top_value();
+  if (collecting) {
+    body.accesses.push_back({node.decl, index, node.is_lvalue});
+  }
+  values.push(invalid());
+}
+void DependenceAnalyzer::visit(ArrayAddressAST &node) {
+  values.push(invalid());
+}
+
+// operators.hh
+void DependenceAnalyzer::visit(UnaryOperatorAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+void DependenceAnalyzer::visit(BinaryOperatorAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+
+void DependenceAnalyzer::visit(ArithBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  Polynomial rval = get_top_value();
+  Polynomial lval = get_top_value();
+
+  if (node.op == OperatorType::ADD) {
+    values.push(add(lval, rval, 1));
+  } else if (node.op == OperatorType::SUB) {
+    values.push(add(lval, rval, -1));
+  } else if (node.op == OperatorType::MUL) {
+    values.push(multiply(lval, rval));
+  } else {
+    values.push(invalid());
+  }
+}
+
+void DependenceAnalyzer::visit(CondBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  values.pop();
+  values.pop();
+  values.push(invalid());
+}
+
+void DependenceAnalyzer::visit(RelBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  values.pop();
+  values.pop();
+  values.push(invalid());
+}
+
+void DependenceAnalyzer::visit(EqBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  values.pop();
+  values.pop();
+  values.push(invalid());
+}
+
+void DependenceAnalyzer::visit(UnaryMinusAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.val});
+    return;
+  }
+
+  Polynomial val = get_top_value();
+  values.push(multiply(val, constant(-1)));
+}
+
+void DependenceAnalyzer::visit(UnaryNotAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.val});
+    return;
+  }
+
+  values.pop();
+  values.push(invalid());
+}
+
+// statements.hh
+void DependenceAnalyzer::visit(ReturnStatementAST &node) {
+  if (node.ret_expr) {
+    get_value(*node.ret_expr);
+  }
+  body.has_return = true;
+}
+
+void DependenceAnalyzer::visit(BreakStatementAST &node) {
+  if (body.depth == 0) {
+    body.has_jump = true;
+  }
+}
+
+void DependenceAnalyzer::visit(ContinueStatementAST &node) {
+  if (body.depth == 0) {
+    body.has_jump = true;
+  }
+}
+
+void DependenceAnalyzer::visit(IfStatementAST &node) {
+  get_value(*node.cond_expr);
+  node.then_block->accept(*this);
+  if (node.else_block) {
+    node.else_block->accept(*this);
+  }
+}
+
+void DependenceAnalyzer::visit(ForStatementAST &node) {
+  if (collecting) {
+    // a loop nested in the analyzed one
+    body.declared.insert(node.iterator);
+    Polynomial start = get_value(*node.start_expr);
+    Polynomial end = get_value(*node.end_expr);
+    body.loops[node.iterator] = {&node, start, end};
+    body.depth++;
+    node.block->accept(*this);
+    body.depth--;
+    return;
+  }
+
+  loops++;
+  if (node.parallel) {
+    // (`parallel for`, checked by semantic analysis)
+    parallel++;
+    return;
+  }
+  // (or the loops inside it)
+  if (!analyze_loop(node)) {
+    node.block->accept(*this);
+  }
+}
+
+void DependenceAnalyzer::visit(AssignStatementAST &node) {
+  get_value(*node.rval);
+  get_value(*node.lloc);
+  if (collecting && node.lloc->index_expr == nullptr) {
+    auto it = body.written.emplace(node.lloc->decl, true).first;
+    it->second = it->second && node.op != OperatorType::ASSIGN;
+  }
+}
+
+// blocks.hh
+void DependenceAnalyzer::visit(StatementBlockAST &node) {
+  if (collecting) {
+    body.declared.insert(node.variable_declarations.begin(),
+                         node.variable_declarations.end());
+  }
+
+  for (auto statement : node.statements) {
+    work.run(*statement, *this);
+    // (the value of a method call statement)
+    while (!values.empty()) {
+      values.pop();
+    }
+  }
+}
+
+// methods.hh
+void DependenceAnalyzer::visit(MethodDeclarationAST &node) {
+  node.body->accept(*this);
+}
+
+void DependenceAnalyzer::visit(MethodCallAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, node.arguments);
+    return;
+  }
+
+  for (unsigned i = 0; i < node.arguments.size(); i++) {
+    values.pop();
+  }
+  body.has_call = true;
+  values.push(invalid());
+}
+
+void DependenceAnalyzer::visit(CalloutCallAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, node.arguments);
+    return;
+  }
+
+  for (unsigned i = 0; i < node.arguments.size(); i++) {
+    values.pop();
+  }
+  body.has_call = true;
+  values.push(invalid());
+}
+
+// program.hh
+void DependenceAnalyzer::visit(ProgramAST &node) {
+  for (auto method : node.methods) {
+    method->accept(*this);
+  }
+}
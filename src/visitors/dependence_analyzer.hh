@@ -0,0 +1,136 @@
+#pragma once
+
+#include <map>
+#include <ostream>
+#include <set>
+#include <stack>
+#include <vector>
+
+#include "visitor.hh"
+#include "work_stack.hh"
+
+// Finds for loops whose iterations are independent, and marks them
+// ForStatementAST::parallel (to be run in chunks on the thread pool, see
+// CodeGenerator). Run on a checked AST, after loop nest optimization.
+//
+// The body of such a loop makes no calls, doesn't return or leave the loop,
+// and only assigns to:
+//  - its own variables (declared in it),
+//  - scalars it adds to (`x += e` / `x -= e`) and never reads: reductions,
+//    summed per chunk and added up after the loop,
+//  - elements of arrays that it only accesses at one index (polynomial in
+//    the scalars), which no two iterations share: `i * P + R`, with a
+//    non-zero constant P larger than the spread of R over the iterators of
+//    the inner loops, or `i * P + j + b`, with j running over [0, P).
+// Only the outermost such loop of a nest is marked.
+class DependenceAnalyzer : public ASTvisitor {
+public:
+  DependenceAnalyzer() : collecting(false), loops(0), parallel(0) {}
+  virtual ~DependenceAnalyzer() = default;
+
+  void analyze(BaseAST &root);
+  void display_stats(std::ostream &out);
+
+private:
+  // an int expression as a polynomial over the scalars, if it is one
+  struct Polynomial {
+    bool valid;
+    // coefficients of the monomials (the variables multiplied, sorted; none
+    // for the constant term), absent if 0
+    std::map<std::vector<VariableDeclarationAST *>, long long> terms;
+  };
+  static Polynomial constant(long long value);
+  static Polynomial variable(VariableDeclarationAST *decl);
+  static Polynomial invalid();
+  // a + sign * b, a * b (invalid if a coefficient doesn't fit in an int)
+  static Polynomial add(const Polynomial &a, const Polynomial &b, int sign);
+  static Polynomial multiply(const Polynomial &a, const Polynomial &b);
+
+  WorkStack work;
+  std::stack<Polynomial> values;
+  Polynomial get_top_value();
+  Polynomial get_value(BaseAST &expr);
+
+  struct Access {
+    VariableDeclarationAST *array;
+    Polynomial index;
+    bool write;
+  };
+  struct InnerLoop {
+    ForStatementAST *node;
+    Polynomial start, end;
+  };
+  // what the body of the loop being analyzed does (including nested loops)
+  struct Body {
+    std::set<VariableDeclarationAST *> declared, read;
+    // scalars assigned, and whether only by += / -=
+    std::map<VariableDeclarationAST *, bool> written;
+    std::vector<Access> accesses;
+    // nested loops, by iterator
+    std::map<VariableDeclarationAST *, InnerLoop> loops;
+    bool has_call, has_return;
+    bool has_jump; // break/continue of the analyzed loop
+    int depth;     // of nested loops
+  };
+  Body body;
+  // whether the visits are collecting `body` (or looking for loops)
+  bool collecting;
+
+  // whether every variable of `value` is the iterator, the iterator of a
+  // nested loop, or not assigned in the body
+  bool is_affine_index(const Polynomial &value, ForStatementAST &node);
+  // whether the iterations access disjoint elements at `index`
+  bool is_disjoint(const Polynomial &index, ForStatementAST &node);
+  // mark `node` if its iterations are independent
+  bool analyze_loop(ForStatementAST &node);
+
+  // statistics
+  int loops, parallel;
+
+public:
+  // visits:
+  virtual void visit(BaseAST &node);
+
+  // literals.hh
+  virtual void visit(LiteralAST &node);
+  virtual void visit(IntegerLiteralAST &node);
+  virtual void visit(BooleanLiteralAST &node);
+  virtual void visit(StringLiteralAST &node);
+
+  // variables.hh
+  virtual void visit(LocationAST &node);
+  virtual void visit(VariableLocationAST &node);
+  virtual void visit(ArrayLocationAST &node);
+  virtual void visit(ArrayAddressAST &node);
+  virtual void visit(VariableDeclarationAST &node) {}
+  virtual void visit(ArrayDeclarationAST &node) {}
+
+  // operators.hh
+  virtual void visit(UnaryOperatorAST &node);
+  virtual void visit(BinaryOperatorAST &node);
+  virtual void visit(ArithBinOperatorAST &node);
+  virtual void visit(CondBinOperatorAST &node);
+  virtual void visit(RelBinOperatorAST &node);
+  virtual void visit(EqBinOperatorAST &node);
+  virtual void visit(UnaryMinusAST &node);
+  virtual void visit(UnaryNotAST &node);
+
+  // statements.hh
+  virtual void visit(ReturnStatementAST &node);
+  virtual void visit(BreakStatementAST &node);
+  virtual void visit(ContinueStatementAST &node);
+  virtual void visit(IfStatementAST &node);
+  virtual void visit(ForStatementAST &node);
+  virtual void visit(AssignStatementAST &node);
+
+  // blocks.hh
+  virtual void visit(StatementBlockAST &node);
+
+  // methods.hh
+  virtual void visit(MethodDeclarationAST &node);
+  virtual void visit(MethodCallAST &node);
+  virtual void visit(CalloutCallAST &node);
+
+  // program.hh
+  virtual void visit(ProgramAST &node);
+};
@@ -0,0 +1,282 @@
+#include "../ast/ast.hh"
+#include "../ast/blocks.hh"
+#include "../ast/literals.hh"
+#include "../ast/methods.hh"
+#include "../ast/operators.hh"
+#include "../ast/program.hh"
+#include "../ast/statements.hh"
+#include "../ast/variables.hh"
+#include "../builtins/signatures.hh"
+#include "../exceptions.hh"
+#include "effect_analyzer.hh"
+
+void EffectAnalyzer::analyze(BaseAST &root) {
+  root.accept(*this);
+
+  // (the effects of every method reachable from it, in its own included)
+  for (auto start : methods) {
+    MethodEffects effects = own_effects[start];
+    effects.recursive = false;
+    std::set<MethodDeclarationAST *> seen;
+    std::vector<MethodDeclarationAST *> stack(callees[start].begin(),
+                                              callees[start].end());
+    while (!stack.empty()) {
+      MethodDeclarationAST *callee = stack.back();
+      stack.pop_back();
+      if (!seen.insert(callee).second)
+        continue;
+
+      effects.recursive |= callee == start;
+      const MethodEffects &other = own_effects[callee];
+      effects.reads_globals |= other.reads_globals;
+      effects.writes_globals |= other.writes_globals;
+      effects.io |= other.io;
+      effects.fails |= other.fails;
+      effects.loops |= other.loops;
+      effects.unknown |= other.unknown;
+      stack.insert(stack.end(), callees[callee].begin(), callees[callee].end());
+    }
+    start->effects = effects;
+  }
+
+  std::vector<MethodDeclarationAST *> stack(parallel_callees.begin(),
+                                            parallel_callees.end());
+  while (!stack.empty()) {
+    MethodDeclarationAST *callee = stack.back();
+    stack.pop_back();
+    if (callee->runs_in_parallel)
+      continue;
+    callee->runs_in_parallel = true;
+    stack.insert(stack.end(), callees[callee].begin(), callees[callee].end());
+  }
+}
+
+void EffectAnalyzer::display_stats(std::ostream &out) {
+  for (auto method : methods) {
+    const MethodEffects &effects = method->effects;
+    out << "effect analysis: `" << method->name << "`:";
+    if (effects.unknown) {
+      out << " unknown";
+    } else {
+      if (effects.reads_globals)
+        out << " reads-globals";
+      if (effects.writes_globals)
+        out << " writes-globals";
+      if (effects.io)
+        out << " io";
+      if (effects.fails)
+        out << " fails";
+      if (effects.loops)
+        out << " loops";
+      if (effects.recursive)
+        out << " recursive";
+    }
+    out << "\n";
+  }
+}
+
+void EffectAnalyzer::access(VariableDeclarationAST *decl, bool read,
+                            bool write) {
+  if (!decl->is_global)
+    return;
+  MethodEffects &effects = own_effects[method];
+  effects.reads_globals |= read;
+  effects.writes_globals |= write;
+}
+
+// Visit functions
+void EffectAnalyzer::visit(BaseAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+
+// literals.hh
+void EffectAnalyzer::visit(LiteralAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+
+// variables.hh
+void EffectAnalyzer::visit(LocationAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+void EffectAnalyzer::visit(VariableLocationAST &node) {
+  // (assignments mark their location, see AssignStatementAST)
+  if (!node.is_lvalue) {
+    access(node.decl, true, false);
+  }
+}
+void EffectAnalyzer::visit(ArrayLocationAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.index_expr});
+    return;
+  }
+
+  if (!node.is_lvalue) {
+    access(node.decl, true, false);
+  }
+  if (node.needs_bounds_check && bounds_checks) {
+    own_effects[method].fails = true;
+  }
+}
+
+// operators.hh
+void EffectAnalyzer::visit(UnaryOperatorAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+void EffectAnalyzer::visit(BinaryOperatorAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+
+// (only the operands have effects)
+void EffectAnalyzer::visit(ArithBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+  }
+}
+void EffectAnalyzer::visit(CondBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+  }
+}
+void EffectAnalyzer::visit(RelBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+  }
+}
+void EffectAnalyzer::visit(EqBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+  }
+}
+void EffectAnalyzer::visit(UnaryMinusAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.val});
+  }
+}
+void EffectAnalyzer::visit(UnaryNotAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.val});
+  }
+}
+
+// statements.hh
+void EffectAnalyzer::visit(ReturnStatementAST &node) {
+  if (node.ret_expr) {
+    work.run(*node.ret_expr, *this);
+  }
+  returns = true;
+}
+
+void EffectAnalyzer::visit(IfStatementAST &node) {
+  work.run(*node.cond_expr, *this);
+
+  returns = false;
+  node.then_block->accept(*this);
+  bool then_returns = returns;
+  returns = false;
+  if (node.else_block) {
+    node.else_block->accept(*this);
+  }
+  returns = then_returns && returns;
+}
+
+void EffectAnalyzer::visit(ForStatementAST &node) {
+  work.run(*node.start_expr, *this);
+  work.run(*node.end_expr, *this);
+
+  MethodEffects &effects = own_effects[method];
+  if (node.iterator->assign_count > 0) {
+    effects.loops = true;
+  }
+  if (!node.hoisted_checks.empty() && bounds_checks) {
+    effects.fails = true;
+  }
+  if (node.parallel) {
+    effects.unknown = true;
+  }
+
+  parallel_depth += node.parallel;
+  node.block->accept(*this);
+  parallel_depth -= node.parallel;
+  // (the body may not run)
+  returns = false;
+}
+
+void EffectAnalyzer::visit(AssignStatementAST &node) {
+  work.run(*node.lloc, *this);
+  work.run(*node.rval, *this);
+  access(node.lloc->decl, node.op != OperatorType::ASSIGN, true);
+}
+
+// blocks.hh
+void EffectAnalyzer::visit(StatementBlockAST &node) {
+  bool block_returns = false;
+  for (auto statement : node.statements) {
+    returns = false;
+    work.run(*statement, *this);
+    block_returns |= returns;
+  }
+  returns = block_returns;
+}
+
+// methods.hh
+void EffectAnalyzer::visit(MethodDeclarationAST &node) {
+  method = &node;
+  methods.push_back(&node);
+  MethodEffects &effects = own_effects[&node];
+  effects.reads_globals = effects.writes_globals = false;
+  effects.io = effects.fails = effects.loops = false;
+  effects.recursive = effects.unknown = false;
+  callees[&node];
+
+  returns = false;
+  node.body->accept(*this);
+  // (a method that doesn't return a value at its end fails there)
+  if (!returns && node.return_type != ValueType::VOID) {
+    own_effects[&node].fails = true;
+  }
+}
+
+void EffectAnalyzer::visit(MethodCallAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, node.arguments);
+    return;
+  }
+
+  callees[method].insert(node.decl);
+  if (parallel_depth > 0) {
+    parallel_callees.insert(node.decl);
+  }
+}
+
+void EffectAnalyzer::visit(CalloutCallAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, node.arguments);
+    return;
+  }
+
+  MethodEffects &effects = own_effects[method];
+  const BuiltinSignature *builtin = find_builtin(node.id);
+  if (builtin == nullptr) {
+    effects.unknown = true;
+    return;
+  }
+
+  effects.io = true;
+  typedef BuiltinSignature::Memory Memory;
+  for (auto arg : node.arguments) {
+    auto array = dynamic_cast<ArrayAddressAST *>(arg);
+    if (array != nullptr) {
+      access(array->decl, builtin->memory == Memory::READS_ARGUMENTS,
+             builtin->memory == Memory::WRITES_ARGUMENTS);
+      // (the range accessed is checked)
+      effects.fails |= bounds_checks;
+    }
+  }
+}
+
+// program.hh
+void EffectAnalyzer::visit(ProgramAST &node) {
+  for (auto method : node.methods) {
+    method->accept(*this);
+  }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <map>
+#include <ostream>
+#include <set>
+#include <vector>
+
+#include "../ast/methods.hh"
+#include "visitor.hh"
+#include "work_stack.hh"
+
+// Computes the effects of every method (MethodDeclarationAST::effects), for
+// code generation to declare them with function attributes (nounwind,
+// norecurse, readnone/readonly/inaccessiblememonly, willreturn, nosync).
+// Run on a checked AST, after range analysis (bounds checks that are left
+// may fail).
+//
+// Decaf methods don't take pointers, and can only reach memory through the
+// globals, so the effects of a method are those of its own body (accesses
+// to globals, callouts, runtime errors, loops), and of the methods it calls:
+// they are propagated over the call graph, in which a method that can reach
+// itself is recursive. Methods reachable from the body of a parallel loop
+// are marked MethodDeclarationAST::runs_in_parallel.
+class EffectAnalyzer : public ASTvisitor {
+public:
+  EffectAnalyzer(bool _bounds_checks = true)
+      : bounds_checks(_bounds_checks), parallel_depth(0) {}
+  virtual ~EffectAnalyzer() = default;
+
+  void analyze(BaseAST &root);
+  void display_stats(std::ostream &out);
+
+private:
+  // whether array bounds are checked (where not proven safe)
+  bool bounds_checks;
+
+  WorkStack work;
+  // the method being analyzed, the effects of its own body, and the
+  // methods it calls
+  MethodDeclarationAST *method;
+  std::map<MethodDeclarationAST *, MethodEffects> own_effects;
+  std::map<MethodDeclarationAST *, std::set<MethodDeclarationAST *>> callees;
+  std::vector<MethodDeclarationAST *> methods;
+
+  // whether the statements visited so far always return
+  bool returns;
+  // number of enclosing parallel loops, and the methods called in them
+  int parallel_depth;
+  std::set<MethodDeclarationAST *> parallel_callees;
+
+  void access(VariableDeclarationAST *decl, bool read, bool write);
+
+public:
+  // visits:
+  virtual void visit(BaseAST &node);
+
+  // literals.hh
+  virtual void visit(LiteralAST &node);
+  virtual void visit(IntegerLiteralAST &node) {}
+  virtual void visit(BooleanLiteralAST &node) {}
+  virtual void visit(StringLiteralAST &node) {}
+
+  // variables.hh
+  virtual void visit(LocationAST &node);
+  virtual void visit(VariableLocationAST &node);
+  virtual void visit(ArrayLocationAST &node);
+  virtual void visit(ArrayAddressAST &node) {}
+  virtual void visit(VariableDeclarationAST &node) {}
+  virtual void visit(ArrayDeclarationAST &node) {}
+
+  // operators.hh
+  virtual void visit(UnaryOperatorAST &node);
+  virtual void visit(BinaryOperatorAST &node);
+  virtual void visit(ArithBinOperatorAST &node);
+  virtual void visit(CondBinOperatorAST &node);
+  virtual void visit(RelBinOperatorAST &node);
+  virtual void visit(EqBinOperatorAST &node);
+  virtual void visit(UnaryMinusAST &node);
+  virtual void visit(UnaryNotAST &node);
+
+  // statements.hh
+  virtual void visit(ReturnStatementAST &node);
+  virtual void visit(BreakStatementAST &node) {}
+  virtual void visit(ContinueStatementAST &node) {}
+  virtual void visit(IfStatementAST &node);
+  virtual void visit(ForStatementAST &node);
+  virtual void visit(AssignStatementAST &node);
+
+  // blocks.hh
+  virtual void visit(StatementBlockAST &node);
+
+  // methods.hh
+  virtual void visit(MethodDeclarationAST &node);
+  virtual void visit(MethodCallAST &node);
+  virtual void visit(CalloutCallAST &node);
+
+  // program.hh
+  virtual void visit(ProgramAST &node);
+};
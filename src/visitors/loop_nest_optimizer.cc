@@ -0,0 +1,425 @@
+#include <algorithm>
+#include <climits>
+#include <string>
+
+#include "../ast/ast.hh"
+#include "../ast/blocks.hh"
+#include "../ast/literals.hh"
+#include "../ast/methods.hh"
+#include "../ast/operators.hh"
+#include "../ast/program.hh"
+#include "../ast/statements.hh"
+#include "../ast/variables.hh"
+#include "../exceptions.hh"
+#include "loop_nest_optimizer.hh"
+
+void LoopNestOptimizer::optimize(BaseAST &root) { root.accept(*this); }
+
+void LoopNestOptimizer::display_stats(std::ostream &out) {
+  out << "loop nests: interchanged " << interchanged << ", tiled " << tiled
+      << " of " << nests << " perfect nests\n";
+}
+
+LoopNestOptimizer::Constant LoopNestOptimizer::sum(Constant a, Constant b,
+                                                   int sign) {
+  long long value = a.value + sign * b.value;
+  return {a.known && b.known && value >= INT_MIN && value <= INT_MAX, value};
+}
+LoopNestOptimizer::Constant LoopNestOptimizer::scale(Constant a, Constant b) {
+  if ((a.known && a.value == 0) || (b.known && b.value == 0))
+    return {true, 0};
+  long long value = a.value * b.value;
+  return {a.known && b.known && value >= INT_MIN && value <= INT_MAX, value};
+}
+
+LoopNestOptimizer::Affine LoopNestOptimizer::invariant(Constant constant) {
+  return {true, {}, constant};
+}
+LoopNestOptimizer::Affine LoopNestOptimizer::non_affine() {
+  return {false, {}, {false, 0}};
+}
+
+LoopNestOptimizer::Affine LoopNestOptimizer::add(const Affine &a,
+                                                 const Affine &b, int sign) {
+  if (!a.affine || !b.affine)
+    return non_affine();
+
+  Affine res = a;
+  for (auto &term : b.coefficients) {
+    auto it = res.coefficients.find(term.first);
+    Constant coefficient = sum(
+        it != res.coefficients.end() ? it->second : Constant{true, 0},
+        term.second, sign);
+    if (coefficient.known && coefficient.value == 0) {
+      res.coefficients.erase(term.first);
+    } else {
+      res.coefficients[term.first] = coefficient;
+    }
+  }
+  res.constant = sum(a.constant, b.constant, sign);
+  return res;
+}
+
+LoopNestOptimizer::Affine LoopNestOptimizer::multiply(const Affine &a,
+                                                      const Affine &b) {
+  if (!a.affine || !b.affine ||
+      (!a.coefficients.empty() && !b.coefficients.empty()))
+    return non_affine();
+
+  // (one side doesn't depend on the iterators)
+  const Affine &factor = a.coefficients.empty() ? a : b;
+  const Affine &other = a.coefficients.empty() ? b : a;
+  Affine res = invariant(scale(other.constant, factor.constant));
+  for (auto &term : other.coefficients) {
+    Constant coefficient = scale(term.second, factor.constant);
+    if (!coefficient.known || coefficient.value != 0) {
+      res.coefficients[term.first] = coefficient;
+    }
+  }
+  return res;
+}
+
+LoopNestOptimizer::Affine LoopNestOptimizer::get_top_value() {
+  Affine res = values.top();
+  values.pop();
+  return res;
+}
+LoopNestOptimizer::Affine LoopNestOptimizer::analyze(BaseAST &expr) {
+  work.run(expr, *this);
+  return get_top_value();
+}
+
+bool LoopNestOptimizer::optimize_nest(ForStatementAST &root) {
+  // loops each containing only the next one
+  std::vector<ForStatementAST *> nest;
+  for (ForStatementAST *loop = &root; loop;) {
+    auto block = static_cast<StatementBlockAST *>(loop->block);
+    if (!block->variable_declarations.empty())
+      return false;
+    nest.push_back(loop);
+    loop = block->statements.size() == 1
+               ? dynamic_cast<ForStatementAST *>(block->statements[0])
+               : nullptr;
+  }
+  if (nest.size() < 2)
+    return false;
+
+  iterators.clear();
+  for (auto loop : nest) {
+    // (`parallel for` loops stay as they are)
+    if (loop->iterator->assign_count > 0 || loop->parallel)
+      return false;
+    iterators.insert(loop->iterator);
+  }
+
+  // the bounds don't depend on the iterators, and can be evaluated once,
+  // before the nest (no array accesses, calls or divisions that could fail)
+  accesses.clear();
+  impure = divides = false;
+  for (auto loop : nest) {
+    for (auto bound : {loop->start_expr, loop->end_expr}) {
+      Affine value = analyze(*bound);
+      if (!value.affine || !value.coefficients.empty())
+        return false;
+    }
+  }
+  if (!accesses.empty() || impure || divides)
+    return false;
+
+  // the body only updates array elements
+  auto body = static_cast<StatementBlockAST *>(nest.back()->block);
+  if (body->statements.empty())
+    return false;
+  for (auto stmt : body->statements) {
+    auto assign = dynamic_cast<AssignStatementAST *>(stmt);
+    if (!assign || !assign->lloc->index_expr ||
+        assign->op == OperatorType::ASSIGN)
+      return false;
+    analyze(*assign->rval);
+    analyze(*assign->lloc);
+  }
+  if (impure)
+    return false;
+
+  // dependences: updates (+= / -=) of an element commute, so the iterations
+  // can run in any order, as long as the updated arrays aren't read
+  std::set<VariableDeclarationAST *> written;
+  for (auto &access : accesses) {
+    if (access.write) {
+      written.insert(access.array);
+    }
+  }
+  for (auto &access : accesses) {
+    if (!access.index.affine || (!access.write && written.count(access.array)))
+      return false;
+  }
+  nests++;
+
+  // cost of each loop as the innermost one: roughly the cache lines touched
+  // per iteration (an invariant access touches none, a unit-stride one a
+  // new line every LINE iterations, any other one a new line every time)
+  static const int LINE = 16;
+  std::vector<int> cost(nest.size(), 0);
+  std::vector<bool> used(nest.size(), false);
+  for (unsigned l = 0; l < nest.size(); l++) {
+    for (auto &access : accesses) {
+      auto it = access.index.coefficients.find(nest[l]->iterator);
+      if (it == access.index.coefficients.end())
+        continue;
+      used[l] = true;
+      Constant stride = it->second;
+      cost[l] += stride.known && (stride.value == 1 || stride.value == -1)
+                     ? 1
+                     : LINE;
+    }
+  }
+
+  // loops that index nothing (they repeat the nest) stay outermost, the
+  // others go inwards by decreasing cost
+  std::vector<unsigned> order;
+  for (unsigned l = 0; l < nest.size(); l++) {
+    order.push_back(l);
+  }
+  std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+    if (used[a] != used[b])
+      return !used[a];
+    return cost[a] > cost[b];
+  });
+
+  if (interchange && !std::is_sorted(order.begin(), order.end())) {
+    struct Header {
+      std::string iterator_id;
+      VariableDeclarationAST *iterator;
+      BaseAST *start_expr, *end_expr;
+    };
+    std::vector<Header> headers;
+    std::vector<bool> reordered_used;
+    for (auto l : order) {
+      headers.push_back({nest[l]->iterator_id, nest[l]->iterator,
+                         nest[l]->start_expr, nest[l]->end_expr});
+      reordered_used.push_back(used[l]);
+    }
+    for (unsigned l = 0; l < nest.size(); l++) {
+      nest[l]->iterator_id = headers[l].iterator_id;
+      nest[l]->iterator = headers[l].iterator;
+      nest[l]->start_expr = headers[l].start_expr;
+      nest[l]->end_expr = headers[l].end_expr;
+    }
+    used = reordered_used;
+    interchanged++;
+  }
+
+  // tile the innermost loops that index arrays
+  if (tile_size > 0) {
+    unsigned first = nest.size();
+    while (first > 0 && used[first - 1]) {
+      first--;
+    }
+    if (nest.size() - first >= 2) {
+      for (unsigned l = first; l < nest.size(); l++) {
+        nest[l]->tile_size = tile_size;
+      }
+      tiled++;
+    }
+  }
+  return true;
+}
+
+// Visit functions
+void LoopNestOptimizer::visit(BaseAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+
+// literals.hh
+void LoopNestOptimizer::visit(LiteralAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+void LoopNestOptimizer::visit(IntegerLiteralAST &node) {
+  values.push(invariant({true, node.value}));
+}
+void LoopNestOptimizer::visit(BooleanLiteralAST &node) {
+  values.push(non_affine());
+}
+void LoopNestOptimizer::visit(StringLiteralAST &node) {
+  values.push(non_affine());
+}
+
+// variables.hh
+void LoopNestOptimizer::visit(LocationAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+void LoopNestOptimizer::visit(VariableLocationAST &node) {
+  if (iterators.count(node.decl)) {
+    values.push({true, {{node.decl, {true, 1}}}, {true, 0}});
+  } else {
+    values.push(invariant({false, 0}));
+  }
+}
+void LoopNestOptimizer::visit(ArrayLocationAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.index_expr});
+    return;
+  }
+
+  Affine index = get_top_value();
+  accesses.push_back({node.decl, index, node.is_lvalue});
+  if (index.affine && index.coefficients.empty()) {
+    values.push(invariant({false, 0}));
+  } else {
+    values.push(non_affine());
+  }
+}
+void LoopNestOptimizer::visit(ArrayAddressAST &node) {
+  values.push(non_affine());
+}
+
+// operators.hh
+void LoopNestOptimizer::visit(UnaryOperatorAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+void LoopNestOptimizer::visit(BinaryOperatorAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+
+void LoopNestOptimizer::visit(ArithBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  Affine rval = get_top_value();
+  Affine lval = get_top_value();
+
+  if (node.op == OperatorType::ADD) {
+    values.push(add(lval, rval, 1));
+  } else if (node.op == OperatorType::SUB) {
+    values.push(add(lval, rval, -1));
+  } else if (node.op == OperatorType::MUL) {
+    values.push(multiply(lval, rval));
+  } else {
+    divides = true;
+    if (lval.affine && rval.affine && lval.coefficients.empty() &&
+        rval.coefficients.empty()) {
+      values.push(invariant({false, 0}));
+    } else {
+      values.push(non_affine());
+    }
+  }
+}
+
+void LoopNestOptimizer::visit(CondBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  values.pop();
+  values.pop();
+  values.push(non_affine());
+}
+
+void LoopNestOptimizer::visit(RelBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  values.pop();
+  values.pop();
+  values.push(non_affine());
+}
+
+void LoopNestOptimizer::visit(EqBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  values.pop();
+  values.pop();
+  values.push(non_affine());
+}
+
+void LoopNestOptimizer::visit(UnaryMinusAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.val});
+    return;
+  }
+
+  Affine val = get_top_value();
+  values.push(multiply(val, invariant({true, -1})));
+}
+
+void LoopNestOptimizer::visit(UnaryNotAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.val});
+    return;
+  }
+
+  values.pop();
+  values.push(non_affine());
+}
+
+// statements.hh
+void LoopNestOptimizer::visit(IfStatementAST &node) {
+  node.then_block->accept(*this);
+  if (node.else_block) {
+    node.else_block->accept(*this);
+  }
+}
+
+void LoopNestOptimizer::visit(ForStatementAST &node) {
+  // (or the nests inside it)
+  if (!optimize_nest(node)) {
+    node.block->accept(*this);
+  }
+}
+
+// blocks.hh
+void LoopNestOptimizer::visit(StatementBlockAST &node) {
+  for (auto statement : node.statements) {
+    work.run(*statement, *this);
+    // (the value of a method call statement)
+    while (!values.empty()) {
+      values.pop();
+    }
+  }
+}
+
+// methods.hh
+void LoopNestOptimizer::visit(MethodDeclarationAST &node) {
+  node.body->accept(*this);
+}
+
+void LoopNestOptimizer::visit(MethodCallAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, node.arguments);
+    return;
+  }
+
+  for (unsigned i = 0; i < node.arguments.size(); i++) {
+    values.pop();
+  }
+  impure = true;
+  values.push(non_affine());
+}
+
+void LoopNestOptimizer::visit(CalloutCallAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, node.arguments);
+    return;
+  }
+
+  for (unsigned i = 0; i < node.arguments.size(); i++) {
+    values.pop();
+  }
+  impure = true;
+  values.push(non_affine());
+}
+
+// program.hh
+void LoopNestOptimizer::visit(ProgramAST &node) {
+  for (auto method : node.methods) {
+    method->accept(*this);
+  }
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <map>
+#include <ostream>
+#include <set>
+#include <stack>
+#include <vector>
+
+#include "visitor.hh"
+#include "work_stack.hh"
+
+// Interchange and tiling of perfect loop nests, run on a checked AST before
+// range analysis.
+//
+// Handles nests of for loops that each contain only the next one, with a
+// body of array updates (`+=`/`-=`) whose indices are affine in the
+// iterators, and with bounds that don't depend on the iterators. Such a nest
+// can run its iterations in any order when the arrays it writes are never
+// read in it (the updates commute): loops are then reordered to make the
+// inner accesses unit-stride (or invariant), and tiled by setting
+// ForStatementAST::tile_size (see CodeGenerator).
+class LoopNestOptimizer : public ASTvisitor {
+public:
+  LoopNestOptimizer(bool _interchange, int _tile_size)
+      : interchange(_interchange), tile_size(_tile_size), impure(false),
+        divides(false), nests(0), interchanged(0), tiled(0) {}
+  virtual ~LoopNestOptimizer() = default;
+
+  void optimize(BaseAST &root);
+  void display_stats(std::ostream &out);
+
+private:
+  bool interchange;
+  int tile_size;
+
+  // a constant, if known at compile time
+  struct Constant {
+    bool known;
+    long long value;
+  };
+  // an int expression: affine in the iterators of the nest (other variables
+  // are invariant), or not
+  struct Affine {
+    bool affine;
+    // coefficients of the iterators (absent if 0)
+    std::map<VariableDeclarationAST *, Constant> coefficients;
+    // constant term
+    Constant constant;
+  };
+  // a + sign * b, a * b (unknown if they don't fit in an int)
+  static Constant sum(Constant a, Constant b, int sign);
+  static Constant scale(Constant a, Constant b);
+
+  static Affine invariant(Constant constant);
+  static Affine non_affine();
+  // a + sign * b, a * b
+  static Affine add(const Affine &a, const Affine &b, int sign);
+  static Affine multiply(const Affine &a, const Affine &b);
+
+  struct Access {
+    VariableDeclarationAST *array;
+    Affine index;
+    bool write;
+  };
+
+  WorkStack work;
+  std::stack<Affine> values;
+  Affine get_top_value();
+  // analyze an expression
+  Affine analyze(BaseAST &expr);
+
+  // iterators of the nest being analyzed
+  std::set<VariableDeclarationAST *> iterators;
+  // what the analyzed expressions do
+  std::vector<Access> accesses;
+  bool impure, divides;
+
+  // reorder/tile the perfect nest starting at `root`, returns false if it
+  // isn't one that can be
+  bool optimize_nest(ForStatementAST &root);
+
+  // statistics
+  int nests, interchanged, tiled;
+
+public:
+  // visits:
+  virtual void visit(BaseAST &node);
+
+  // literals.hh
+  virtual void visit(LiteralAST &node);
+  virtual void visit(IntegerLiteralAST &node);
+  virtual void visit(BooleanLiteralAST &node);
+  virtual void visit(StringLiteralAST &node);
+
+  // variables.hh
+  virtual void visit(LocationAST &node);
+  virtual void visit(VariableLocationAST &node);
+  virtual void visit(ArrayLocationAST &node);
+  virtual void visit(ArrayAddressAST &node);
+  virtual void visit(VariableDeclarationAST &node) {}
+  virtual void visit(ArrayDeclarationAST &node) {}
+
+  // operators.hh
+  virtual void visit(UnaryOperatorAST &node);
+  virtual void visit(BinaryOperatorAST &node);
+  virtual void visit(ArithBinOperatorAST &node);
+  virtual void visit(CondBinOperatorAST &node);
+  virtual void visit(RelBinOperatorAST &node);
+  virtual void visit(EqBinOperatorAST &node);
+  virtual void visit(UnaryMinusAST &node);
+  virtual void visit(UnaryNotAST &node);
+
+  // statements.hh
+  virtual void visit(ReturnStatementAST &node) {}
+  virtual void visit(BreakStatementAST &node) {}
+  virtual void visit(ContinueStatementAST &node) {}
+  virtual void visit(IfStatementAST &node);
+  virtual void visit(ForStatementAST &node);
+  virtual void visit(AssignStatementAST &node) {}
+
+  // blocks.hh
+  virtual void visit(StatementBlockAST &node);
+
+  // methods.hh
+  virtual void visit(MethodDeclarationAST &node);
+  virtual void visit(MethodCallAST &node);
+  virtual void visit(CalloutCallAST &node);
+
+  // program.hh
+  virtual void visit(ProgramAST &node);
+};
@@ -0,0 +1,352 @@
+#include <algorithm>
+#include <climits>
+
+#include "../ast/ast.hh"
+#include "../ast/blocks.hh"
+#include "../ast/literals.hh"
+#include "../ast/methods.hh"
+#include "../ast/operators.hh"
+#include "../ast/program.hh"
+#include "../ast/statements.hh"
+#include "../ast/variables.hh"
+#include "../builtins/signatures.hh"
+#include "../exceptions.hh"
+#include "range_analyzer.hh"
+
+const RangeAnalyzer::Range RangeAnalyzer::UNKNOWN = {INT_MIN, INT_MAX};
+
+RangeAnalyzer::Range RangeAnalyzer::checked(Range range) {
+  if (range.lo < INT_MIN || range.hi > INT_MAX)
+    return UNKNOWN;
+  return range;
+}
+
+void RangeAnalyzer::analyze(BaseAST &root) { root.accept(*this); }
+
+void RangeAnalyzer::display_stats(std::ostream &out) {
+  for (auto &method : stats) {
+    out << "range analysis: `" << method.name << "`: eliminated "
+        << method.eliminated << ", hoisted " << method.hoisted << " of "
+        << method.accesses << " bounds checks\n";
+  }
+}
+
+RangeAnalyzer::Value RangeAnalyzer::get_top_value() {
+  Value res = values.top();
+  values.pop();
+  return res;
+}
+RangeAnalyzer::Range RangeAnalyzer::get_range(BaseAST &expr) {
+  used_vars.clear();
+  work.run(expr, *this);
+  return get_top_value().range;
+}
+
+void RangeAnalyzer::hoist(Loop &loop) {
+  // every access runs on every iteration, and a check failing before the
+  // loop doesn't skip any of its output
+  if (loop.has_return || loop.has_jump || loop.has_output)
+    return;
+
+  for (auto &candidate : loop.candidates) {
+    bool invariant = true;
+    for (auto var : candidate.second) {
+      if (loop.assigned.count(var)) {
+        invariant = false;
+      }
+    }
+    if (invariant) {
+      candidate.first->needs_bounds_check = false;
+      loop.node->hoisted_checks.push_back(candidate.first);
+      stats.back().hoisted++;
+    }
+  }
+}
+
+// Visit functions
+void RangeAnalyzer::visit(BaseAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+
+// literals.hh
+void RangeAnalyzer::visit(LiteralAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+void RangeAnalyzer::visit(IntegerLiteralAST &node) {
+  values.push({{node.value, node.value}, Form::INVARIANT});
+}
+void RangeAnalyzer::visit(BooleanLiteralAST &node) {
+  values.push({UNKNOWN, Form::OTHER});
+}
+void RangeAnalyzer::visit(StringLiteralAST &node) {
+  values.push({UNKNOWN, Form::OTHER});
+}
+
+// variables.hh
+void RangeAnalyzer::visit(LocationAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+void RangeAnalyzer::visit(VariableLocationAST &node) {
+  used_vars.push_back(node.decl);
+  auto it = iterators.find(node.decl);
+  Range range = it != iterators.end() ? it->second : UNKNOWN;
+  if (!loops.empty() && node.decl == loops.back().node->iterator) {
+    values.push({range, Form::AFFINE});
+  } else {
+    values.push({range, Form::INVARIANT});
+  }
+}
+void RangeAnalyzer::visit(ArrayLocationAST &node) {
+  if (work.stage() == 0) {
+    index_marks.push(used_vars.size());
+    work.defer(node, 1, {node.index_expr});
+    return;
+  }
+
+  Value index = get_top_value();
+  unsigned mark = index_marks.top();
+  index_marks.pop();
+
+  auto decl = static_cast<ArrayDeclarationAST *>(node.decl);
+  stats.back().accesses++;
+  if (index.range.lo >= 0 && index.range.hi < decl->array_len) {
+    node.needs_bounds_check = false;
+    stats.back().eliminated++;
+  } else if (hoist_checks && !loops.empty() &&
+             loops.back().conditional == 0 && index.form != Form::OTHER) {
+    loops.back().candidates.emplace_back(
+        &node, std::vector<VariableDeclarationAST *>(
+                   used_vars.begin() + mark, used_vars.end()));
+  }
+
+  values.push({UNKNOWN, Form::OTHER});
+}
+void RangeAnalyzer::visit(ArrayAddressAST &node) {
+  values.push({UNKNOWN, Form::OTHER});
+}
+
+// operators.hh
+void RangeAnalyzer::visit(UnaryOperatorAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+void RangeAnalyzer::visit(BinaryOperatorAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+
+void RangeAnalyzer::visit(ArithBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  Value rval = get_top_value();
+  Value lval = get_top_value();
+  Range l = lval.range, r = rval.range;
+  Form form = std::max(lval.form, rval.form);
+
+  if (node.op == OperatorType::ADD) {
+    values.push({checked({l.lo + r.lo, l.hi + r.hi}), form});
+  } else if (node.op == OperatorType::SUB) {
+    values.push({checked({l.lo - r.hi, l.hi - r.lo}), form});
+  } else if (node.op == OperatorType::MUL) {
+    long long products[] = {l.lo * r.lo, l.lo * r.hi, l.hi * r.lo,
+                            l.hi * r.hi};
+    if (lval.form == Form::AFFINE && rval.form == Form::AFFINE) {
+      form = Form::OTHER;
+    }
+    values.push({checked({*std::min_element(products, products + 4),
+                          *std::max_element(products, products + 4)}),
+                 form});
+  } else {
+    values.push({UNKNOWN, Form::OTHER});
+  }
+}
+
+void RangeAnalyzer::visit(CondBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    if (!loops.empty()) {
+      loops.back().conditional++;
+    }
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  if (!loops.empty()) {
+    loops.back().conditional--;
+  }
+  values.pop();
+  values.pop();
+  values.push({UNKNOWN, Form::OTHER});
+}
+
+void RangeAnalyzer::visit(RelBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  values.pop();
+  values.pop();
+  values.push({UNKNOWN, Form::OTHER});
+}
+
+void RangeAnalyzer::visit(EqBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
+  values.pop();
+  values.pop();
+  values.push({UNKNOWN, Form::OTHER});
+}
+
+void RangeAnalyzer::visit(UnaryMinusAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.val});
+    return;
+  }
+
+  Value val = get_top_value();
+  values.push({checked({-val.range.hi, -val.range.lo}), val.form});
+}
+
+void RangeAnalyzer::visit(UnaryNotAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.val});
+    return;
+  }
+
+  values.pop();
+  values.push({UNKNOWN, Form::OTHER});
+}
+
+// statements.hh
+void RangeAnalyzer::visit(ReturnStatementAST &node) {
+  if (node.ret_expr) {
+    get_range(*node.ret_expr);
+  }
+  if (!loops.empty()) {
+    loops.back().has_return = true;
+  }
+}
+
+void RangeAnalyzer::visit(BreakStatementAST &node) {
+  loops.back().has_jump = true;
+}
+
+void RangeAnalyzer::visit(ContinueStatementAST &node) {
+  loops.back().has_jump = true;
+}
+
+void RangeAnalyzer::visit(IfStatementAST &node) {
+  get_range(*node.cond_expr);
+
+  if (!loops.empty()) {
+    loops.back().conditional++;
+  }
+  node.then_block->accept(*this);
+  if (node.else_block) {
+    node.else_block->accept(*this);
+  }
+  if (!loops.empty()) {
+    loops.back().conditional--;
+  }
+}
+
+void RangeAnalyzer::visit(ForStatementAST &node) {
+  // both bounds are evaluated once, before the loop
+  Range start = get_range(*node.start_expr);
+  Range end = get_range(*node.end_expr);
+
+  // the iterator stays in [start, end - 1], unless the body assigns to it
+  if (node.iterator->assign_count == 0) {
+    iterators[node.iterator] = {start.lo, end.hi - 1};
+  }
+  loops.push_back({&node, {}, false, false, false, 0, {}});
+  node.block->accept(*this);
+  Loop loop = loops.back();
+  loops.pop_back();
+  iterators.erase(node.iterator);
+
+  hoist(loop);
+
+  // (the body of the enclosing loop includes this one)
+  if (!loops.empty()) {
+    Loop &outer = loops.back();
+    outer.assigned.insert(loop.assigned.begin(), loop.assigned.end());
+    outer.has_output |= loop.has_output;
+    outer.has_return |= loop.has_return;
+  }
+}
+
+void RangeAnalyzer::visit(AssignStatementAST &node) {
+  get_range(*node.lloc);
+  get_range(*node.rval);
+
+  if (!loops.empty() && node.lloc->index_expr == nullptr) {
+    loops.back().assigned.insert(node.lloc->decl);
+  }
+}
+
+// blocks.hh
+void RangeAnalyzer::visit(StatementBlockAST &node) {
+  // (variables declared in a loop are reset on every iteration)
+  if (!loops.empty()) {
+    loops.back().assigned.insert(node.variable_declarations.begin(),
+                                 node.variable_declarations.end());
+  }
+
+  for (auto statement : node.statements) {
+    work.run(*statement, *this);
+    // (the value of a method call statement)
+    if (!values.empty()) {
+      values.pop();
+    }
+  }
+}
+
+// methods.hh
+void RangeAnalyzer::visit(MethodDeclarationAST &node) {
+  stats.push_back({node.name, 0, 0, 0});
+  node.body->accept(*this);
+}
+
+void RangeAnalyzer::visit(MethodCallAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, node.arguments);
+    return;
+  }
+
+  // (the method may print, and assign to globals)
+  if (!loops.empty()) {
+    loops.back().has_output = true;
+  }
+  for (unsigned i = 0; i < node.arguments.size(); i++) {
+    values.pop();
+  }
+  values.push({UNKNOWN, Form::OTHER});
+}
+
+void RangeAnalyzer::visit(CalloutCallAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, node.arguments);
+    return;
+  }
+
+  const BuiltinSignature *builtin = find_builtin(node.id);
+  if (!loops.empty() && (builtin == nullptr || builtin->writes_output)) {
+    loops.back().has_output = true;
+  }
+  for (unsigned i = 0; i < node.arguments.size(); i++) {
+    values.pop();
+  }
+  values.push({UNKNOWN, Form::OTHER});
+}
+
+// program.hh
+void RangeAnalyzer::visit(ProgramAST &node) {
+  for (auto method : node.methods) {
+    method->accept(*this);
+  }
+}
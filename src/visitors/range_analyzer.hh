@@ -0,0 +1,138 @@
+#pragma once
+
+#include <map>
+#include <ostream>
+#include <set>
+#include <stack>
+#include <string>
+#include <vector>
+
+#include "visitor.hh"
+#include "work_stack.hh"
+
+// Interval analysis of int expressions, for array bounds-check elimination.
+//
+// Tracks the ranges of literals, for loop iterators (that are not assigned
+// in the loop body) and +, -, * over them; array accesses whose index range
+// is within the array are marked as not needing a bounds check.
+//
+// With `hoist_checks`, the remaining checks of accesses done on every
+// iteration of the innermost loop, with an index affine in its iterator (and
+// otherwise loop invariant), are moved to the loop: see
+// ForStatementAST::hoisted_checks. The check then fails before the loop
+// runs, so loops whose body may print (method calls, and callouts other
+// than reads) keep theirs: the output before the error stays the same.
+class RangeAnalyzer : public ASTvisitor {
+public:
+  RangeAnalyzer(bool _hoist_checks = false) : hoist_checks(_hoist_checks) {}
+  virtual ~RangeAnalyzer() = default;
+
+  void analyze(BaseAST &root);
+  void display_stats(std::ostream &out);
+
+private:
+  // [lo, hi], within the range of int
+  struct Range {
+    long long lo, hi;
+  };
+  static const Range UNKNOWN;
+  // `range`, or UNKNOWN if it doesn't fit in an int (the result wraps)
+  static Range checked(Range range);
+
+  // shape of an int expression, relative to the innermost loop iterator
+  enum class Form {
+    INVARIANT, // literals and scalar variables (if not assigned in the loop)
+    AFFINE,    // a * iterator + b, with invariant a and b
+    OTHER
+  };
+  struct Value {
+    Range range;
+    Form form;
+  };
+
+  WorkStack work;
+  std::stack<Value> values;
+  Value get_top_value();
+  // analyze an expression, and return its range
+  Range get_range(BaseAST &expr);
+
+  // ranges of the iterators of the enclosing loops
+  std::map<VariableDeclarationAST *, Range> iterators;
+
+  bool hoist_checks;
+  // what the body of an enclosing loop does (including nested loops)
+  struct Loop {
+    ForStatementAST *node;
+    std::set<VariableDeclarationAST *> assigned;
+    bool has_output; // callouts or method calls that (may) print
+    bool has_return;
+    bool has_jump; // break/continue of this loop
+    // > 0 inside if blocks and && / || operands
+    int conditional;
+    // accesses to hoist, and the variables used in their index
+    std::vector<std::pair<ArrayLocationAST *,
+                          std::vector<VariableDeclarationAST *>>>
+        candidates;
+  };
+  std::vector<Loop> loops;
+  // variables read so far in the current expression
+  std::vector<VariableDeclarationAST *> used_vars;
+  // used_vars.size() at each enclosing array location
+  std::stack<unsigned> index_marks;
+  // hoist the checks of the candidates of the innermost loop (if valid)
+  void hoist(Loop &loop);
+
+  // bounds checks per method
+  struct MethodStats {
+    std::string name;
+    int accesses, eliminated, hoisted;
+  };
+  std::vector<MethodStats> stats;
+
+public:
+  // visits:
+  virtual void visit(BaseAST &node);
+
+  // literals.hh
+  virtual void visit(LiteralAST &node);
+  virtual void visit(IntegerLiteralAST &node);
+  virtual void visit(BooleanLiteralAST &node);
+  virtual void visit(StringLiteralAST &node);
+
+  // variables.hh
+  virtual void visit(LocationAST &node);
+  virtual void visit(VariableLocationAST &node);
+  virtual void visit(ArrayLocationAST &node);
+  virtual void visit(ArrayAddressAST &node);
+  virtual void visit(VariableDeclarationAST &node) {}
+  virtual void visit(ArrayDeclarationAST &node) {}
+
+  // operators.hh
+  virtual void visit(UnaryOperatorAST &node);
+  virtual void visit(BinaryOperatorAST &node);
+  virtual void visit(ArithBinOperatorAST &node);
+  virtual void visit(CondBinOperatorAST &node);
+  virtual void visit(RelBinOperatorAST &node);
+  virtual void visit(EqBinOperatorAST &node);
+  virtual void visit(UnaryMinusAST &node);
+  virtual void visit(UnaryNotAST &node);
+
+  // statements.hh
+  virtual void visit(ReturnStatementAST &node);
+  virtual void visit(BreakStatementAST &node);
+  virtual void visit(ContinueStatementAST &node);
+  virtual void visit(IfStatementAST &node);
+  virtual void visit(ForStatementAST &node);
+  virtual void visit(AssignStatementAST &node);
+
+  // blocks.hh
+  virtual void visit(StatementBlockAST &node);
+
+  // methods.hh
+  virtual void visit(MethodDeclarationAST &node);
+  virtual void visit(MethodCallAST &node);
+  virtual void visit(CalloutCallAST &node);
+
+  // program.hh
+  virtual void visit(ProgramAST &node);
+};
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cassert>
 #include <cstdarg>
 #include <cstdio>
@@ -10,6 +11,7 @@
 #include "../ast/program.hh"
 #include "../ast/statements.hh"
 #include "../ast/variables.hh"
+#include "../builtins/signatures.hh"
 #include "../exceptions.hh"
 #include "semantic_analyzer.hh"
 
@@ -19,65 +21,104 @@ void SemanticAnalyzer::SymbolTable::block_start() {
     hold_depth--;
     return;
   }
-  variables.emplace_back();
+  scope_marks.push_back(bindings.size());
   scope_depth++;
 }
 void SemanticAnalyzer::SymbolTable::block_end() {
   assert(scope_depth > 1);
-  variables.pop_back();
+  // undo every binding made in this scope
+  int mark = scope_marks.back();
+  scope_marks.pop_back();
+  while ((int)bindings.size() > mark) {
+    Binding &binding = bindings.back();
+    binding.symbol->binding = binding.shadowed;
+    bindings.pop_back();
+  }
   scope_depth--;
 }
 
 void SemanticAnalyzer::silent(bool f) { _silent = f; }
 
+// interning
+SemanticAnalyzer::SymbolTable::Symbol *
+SemanticAnalyzer::SymbolTable::intern(const std::string &name, bool create) {
+  std::size_t mask = table.size() - 1;
+  std::size_t slot = std::hash<std::string>()(name) & mask;
+  while (table[slot] != nullptr) { // linear probing
+    if (table[slot]->name == name)
+      return table[slot];
+    slot = (slot + 1) & mask;
+  }
+  if (!create)
+    return nullptr;
+
+  symbols.push_back(Symbol{name, -1});
+  table[slot] = &symbols.back();
+  if (2 * symbols.size() > table.size()) {
+    rehash();
+  }
+  return &symbols.back();
+}
+void SemanticAnalyzer::SymbolTable::rehash() {
+  std::vector<Symbol *> old_table(2 * table.size(), nullptr);
+  std::swap(table, old_table);
+
+  std::size_t mask = table.size() - 1;
+  for (auto symbol : old_table) {
+    if (symbol == nullptr)
+      continue;
+    std::size_t slot = std::hash<std::string>()(symbol->name) & mask;
+    while (table[slot] != nullptr) {
+      slot = (slot + 1) & mask;
+    }
+    table[slot] = symbol;
+  }
+}
+
+SemanticAnalyzer::SymbolTable::Binding *
+SemanticAnalyzer::SymbolTable::innermost(const std::string &name) {
+  Symbol *symbol = intern(name, false);
+  if (symbol == nullptr || symbol->binding < 0)
+    return nullptr;
+  return &bindings[symbol->binding];
+}
+void SemanticAnalyzer::SymbolTable::bind(Symbol *symbol, SymbolKind kind,
+                                         BaseAST *decl) {
+  bindings.push_back(Binding{symbol, kind, decl, scope_depth, symbol->binding});
+  symbol->binding = bindings.size() - 1;
+}
+
 // add
 void SemanticAnalyzer::SymbolTable::add_variable(
     VariableDeclarationAST *variable) {
-  auto &current_scope = variables.back();
-  if (current_scope.count(variable->id)) {
-    auto previous_decl = current_scope[variable->id];
-    analyzer.log_error(
-        1, variable->location,
-        "Redeclaration of variable `%s` (previously declared at [%s]: `%s`)",
-        variable->id.c_str(), previous_decl->location.c_str(),
-        previous_decl->to_string().c_str());
-    return;
-  }
-
-  if (scope_depth == 1) {
-    if (arrays.count(variable->id)) {
-      auto previous_decl = arrays[variable->id];
+  Symbol *symbol = intern(variable->id);
+  if (symbol->binding >= 0) {
+    // same scope: a variable, or (in global scope) an array
+    auto &previous = bindings[symbol->binding];
+    if (previous.depth == scope_depth) {
       analyzer.log_error(
           1, variable->location,
           "Redeclaration of variable `%s` (previously declared at [%s]: `%s`)",
-          variable->id.c_str(), previous_decl->location.c_str(),
-          previous_decl->to_string().c_str());
+          variable->id.c_str(), previous.decl->location.c_str(),
+          previous.decl->to_string().c_str());
       return;
     }
   }
 
-  current_scope[variable->id] = variable;
+  bind(symbol, SymbolKind::VARIABLE, variable);
 }
 void SemanticAnalyzer::SymbolTable::add_array(ArrayDeclarationAST *array) {
-  if (arrays.count(array->id)) {
-    auto previous_decl = arrays[array->id];
-    analyzer.log_error(
-        1, array->location,
-        "Redeclaration of array `%s` (previously declared at [%s]: `%s`)",
-        array->id.c_str(), previous_decl->location.c_str(),
-        previous_decl->to_string().c_str());
-    return;
-  }
-
-  auto &current_scope = variables[0];
-  if (current_scope.count(array->id)) {
-    auto previous_decl = current_scope[array->id];
-    analyzer.log_error(
-        1, array->location,
-        "Redeclaration of array `%s` (previously declared at [%s]: `%s`)",
-        array->id.c_str(), previous_decl->location.c_str(),
-        previous_decl->to_string().c_str());
-    return;
+  Symbol *symbol = intern(array->id);
+  if (symbol->binding >= 0) {
+    auto &previous = bindings[symbol->binding];
+    if (previous.depth == scope_depth) {
+      analyzer.log_error(
+          1, array->location,
+          "Redeclaration of array `%s` (previously declared at [%s]: `%s`)",
+          array->id.c_str(), previous.decl->location.c_str(),
+          previous.decl->to_string().c_str());
+      return;
+    }
   }
 
   if (array->array_len == 0) {
@@ -86,130 +127,120 @@ void SemanticAnalyzer::SymbolTable::add_array(ArrayDeclarationAST *array) {
                        array->to_string().c_str());
   }
 
-  arrays[array->id] = array;
+  bind(symbol, SymbolKind::ARRAY, array);
 }
 
 void SemanticAnalyzer::SymbolTable::add_method(MethodDeclarationAST *method) {
-  if (methods.count(method->name)) {
-    auto previous_decl = methods[method->name];
-    analyzer.log_error(
-        1, method->location,
-        "Reuse of method name `%s` (previously declared at [%s]: `%s`)",
-        method->name.c_str(), previous_decl->location.c_str(),
-        previous_decl->to_string().c_str());
-    return;
-  }
-
-  auto &global_scope = variables[0];
-  if (global_scope.count(method->name)) {
-    auto previous_decl = global_scope[method->name];
-    analyzer.log_error(1, method->location,
-                       "Invalid reuse of variable name `%s` for method "
-                       "(previously declared at [%s]: `%s`)",
-                       method->name.c_str(), previous_decl->location.c_str(),
-                       previous_decl->to_string().c_str());
-    return;
-  }
-
-  if (arrays.count(method->name)) {
-    auto previous_decl = arrays[method->name];
-    analyzer.log_error(1, method->location,
-                       "Invalid reuse of array name `%s` for method "
-                       "(previously declared at [%s]: `%s`)",
-                       method->name.c_str(), previous_decl->location.c_str(),
-                       previous_decl->to_string().c_str());
+  Symbol *symbol = intern(method->name);
+  if (symbol->binding >= 0) {
+    // methods are declared in global scope, after all fields
+    auto &previous = bindings[symbol->binding];
+    if (previous.kind == SymbolKind::METHOD) {
+      analyzer.log_error(
+          1, method->location,
+          "Reuse of method name `%s` (previously declared at [%s]: `%s`)",
+          method->name.c_str(), previous.decl->location.c_str(),
+          previous.decl->to_string().c_str());
+    } else {
+      analyzer.log_error(
+          1, method->location,
+          "Invalid reuse of %s name `%s` for method "
+          "(previously declared at [%s]: `%s`)",
+          previous.kind == SymbolKind::ARRAY ? "array" : "variable",
+          method->name.c_str(), previous.decl->location.c_str(),
+          previous.decl->to_string().c_str());
+    }
     return;
   }
 
-  methods[method->name] = method;
+  bind(symbol, SymbolKind::METHOD, method);
 }
 
 // lookup
 VariableDeclarationAST *
 SemanticAnalyzer::SymbolTable::lookup_variable(LocationAST *varloc) {
-  for (int i = scope_depth - 1; i >= 0; i--) {
-    if (variables[i].count(varloc->id)) {
-      return variables[i][varloc->id];
-    }
+  Binding *binding = innermost(varloc->id);
+  if (binding == nullptr) {
+    analyzer.log_error(2, varloc->location, "Variable `%s` not declared",
+                       varloc->id.c_str());
+    return nullptr;
   }
 
-  if (arrays.count(varloc->id)) {
-    auto decl = arrays[varloc->id];
+  auto decl = binding->decl;
+  if (binding->kind == SymbolKind::ARRAY) {
     analyzer.log_error(
         9, varloc->location,
         "Invalid use of array `%s` as variable (declared at [%s]: `%s`)",
         varloc->id.c_str(), decl->location.c_str(), decl->to_string().c_str());
-  } else if (methods.count(varloc->id)) {
-    auto decl = methods[varloc->id];
+  } else if (binding->kind == SymbolKind::METHOD) {
     analyzer.log_error(
         9, varloc->location,
         "Invalid use of method `%s` as variable (declared at [%s]: `%s`)",
         varloc->id.c_str(), decl->location.c_str(), decl->to_string().c_str());
   } else {
-    analyzer.log_error(2, varloc->location, "Variable `%s` not declared",
-                       varloc->id.c_str());
+    return static_cast<VariableDeclarationAST *>(decl);
   }
   return nullptr;
 }
 ArrayDeclarationAST *
 SemanticAnalyzer::SymbolTable::lookup_array_element(LocationAST *arrloc) {
-  for (int i = scope_depth - 1; i >= 0; i--) {
-    if (variables[i].count(arrloc->id)) {
-      auto decl = variables[i][arrloc->id];
-      analyzer.log_error(9, arrloc->location,
-                         "Invalid use of scalar variable `%s` as array "
-                         "(declared at [%s]: `%s`)",
-                         arrloc->id.c_str(), decl->location.c_str(),
-                         decl->to_string().c_str());
-      return nullptr;
-    }
+  Binding *binding = innermost(arrloc->id);
+  if (binding == nullptr) {
+    analyzer.log_error(2, arrloc->location, "Array `%s` not declared",
+                       arrloc->id.c_str());
+    return nullptr;
   }
 
-  if (arrays.count(arrloc->id)) {
-    return arrays[arrloc->id];
-  } else if (methods.count(arrloc->id)) {
-    auto decl = methods[arrloc->id];
+  auto decl = binding->decl;
+  if (binding->kind == SymbolKind::VARIABLE) {
+    analyzer.log_error(9, arrloc->location,
+                       "Invalid use of scalar variable `%s` as array "
+                       "(declared at [%s]: `%s`)",
+                       arrloc->id.c_str(), decl->location.c_str(),
+                       decl->to_string().c_str());
+  } else if (binding->kind == SymbolKind::METHOD) {
     analyzer.log_error(
         9, arrloc->location,
         "Invalid use of method `%s` as array (declared at [%s]: `%s`)",
         arrloc->id.c_str(), decl->location.c_str(), decl->to_string().c_str());
   } else {
-    analyzer.log_error(2, arrloc->location, "Array `%s` not declared",
-                       arrloc->id.c_str());
+    return static_cast<ArrayDeclarationAST *>(decl);
   }
   return nullptr;
 }
 
 MethodDeclarationAST *
 SemanticAnalyzer::SymbolTable::lookup_method(MethodCallAST *mcall) {
-  for (int i = scope_depth - 1; i >= 0; i--) {
-    if (variables[i].count(mcall->id)) {
-      auto decl = variables[i][mcall->id];
-      analyzer.log_error(
-          2, mcall->location,
-          "Invalid use of variable `%s` as method (declared at [%s]: `%s`",
-          mcall->id.c_str(), decl->location.c_str(), decl->to_string().c_str());
-      return nullptr;
-    }
+  Binding *binding = innermost(mcall->id);
+  if (binding == nullptr) {
+    analyzer.log_error(2, mcall->location, "Method `%s` not declared",
+                       mcall->id.c_str());
+    return nullptr;
   }
 
-  if (arrays.count(mcall->id)) {
-    auto decl = arrays[mcall->id];
+  auto decl = binding->decl;
+  if (binding->kind == SymbolKind::VARIABLE) {
+    analyzer.log_error(
+        2, mcall->location,
+        "Invalid use of variable `%s` as method (declared at [%s]: `%s`",
+        mcall->id.c_str(), decl->location.c_str(), decl->to_string().c_str());
+  } else if (binding->kind == SymbolKind::ARRAY) {
     analyzer.log_error(
         2, mcall->location,
         "Invalid use of array `%s` as method (declared at [%s]: `%s`",
         mcall->id.c_str(), decl->location.c_str(), decl->to_string().c_str());
-    return nullptr;
-  }
-
-  if (methods.count(mcall->id)) {
-    return methods[mcall->id];
+  } else {
+    return static_cast<MethodDeclarationAST *>(decl);
   }
-
-  analyzer.log_error(2, mcall->location, "Method `%s` not declared",
-                     mcall->id.c_str());
   return nullptr;
 }
+MethodDeclarationAST *
+SemanticAnalyzer::SymbolTable::find_method(const std::string &name) {
+  Binding *binding = innermost(name);
+  if (binding == nullptr || binding->kind != SymbolKind::METHOD)
+    return nullptr;
+  return static_cast<MethodDeclarationAST *>(binding->decl);
+}
 
 /*** SemanticAnalyzer ***/
 void SemanticAnalyzer::log_error(const int error_type,
@@ -232,6 +263,23 @@ void SemanticAnalyzer::log_error(const int error_type,
   errors.emplace_back(error_type, msg);
 }
 
+void SemanticAnalyzer::log_warning(const std::string &location,
+                                   const std::string &fmt, ...) {
+  if (_silent)
+    return;
+
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(_buffer, BUFFER_LENGTH, fmt.c_str(), args);
+  va_end(args);
+
+  std::string msg = "Warning: " + std::string(_buffer);
+  if (!location.empty()) {
+    msg = "[" + location + "] " + msg;
+  }
+  warnings.push_back(msg);
+}
+
 bool SemanticAnalyzer::check(BaseAST &root) {
   symbol_table = new SymbolTable(*this);
   root.accept(*this);
@@ -248,13 +296,19 @@ void SemanticAnalyzer::display(std::ostream &out, const bool show_rules) {
     }
     out << err.second << "\n";
   }
+  for (auto &warning : warnings) {
+    out << warning << "\n";
+  }
+}
+
+void SemanticAnalyzer::add_local(VariableDeclarationAST *decl) {
+  decl->slot = current_method->num_locals++;
+  symbol_table->add_variable(decl);
 }
 
-ValueType SemanticAnalyzer::get_top_type(bool pop) {
-  ValueType res = type_stack.top();
-  if (pop)
-    type_stack.pop();
-  return res;
+ValueType SemanticAnalyzer::get_type(BaseAST &expr) {
+  work.run(expr, *this);
+  return expr.expr_type;
 }
 
 // Visit functions
@@ -266,15 +320,10 @@ void SemanticAnalyzer::visit(BaseAST &node) {
 void SemanticAnalyzer::visit(LiteralAST &node) {
   throw invalid_call_error(__PRETTY_FUNCTION__);
 }
-void SemanticAnalyzer::visit(IntegerLiteralAST &node) {
-  type_stack.push(ValueType::INT);
-}
-void SemanticAnalyzer::visit(BooleanLiteralAST &node) {
-  type_stack.push(ValueType::BOOL);
-}
-void SemanticAnalyzer::visit(StringLiteralAST &node) {
-  type_stack.push(ValueType::STRING);
-}
+// (literal types are set on construction)
+void SemanticAnalyzer::visit(IntegerLiteralAST &node) {}
+void SemanticAnalyzer::visit(BooleanLiteralAST &node) {}
+void SemanticAnalyzer::visit(StringLiteralAST &node) {}
 
 // variables.hh
 void SemanticAnalyzer::visit(LocationAST &node) {
@@ -282,14 +331,25 @@ void SemanticAnalyzer::visit(LocationAST &node) {
 }
 void SemanticAnalyzer::visit(VariableLocationAST &node) {
   auto decl = symbol_table->lookup_variable(&node);
-  type_stack.push(decl ? decl->type : ValueType::NONE);
+  node.decl = decl;
+  node.expr_type = decl ? decl->type : ValueType::NONE;
+
+  // (a local from outside the innermost parallel for)
+  if (decl && !node.is_lvalue && !decl->is_global &&
+      decl->slot < parallel_first_slot) {
+    parallel_reads.insert(decl);
+  }
 }
 void SemanticAnalyzer::visit(ArrayLocationAST &node) {
-  auto decl = symbol_table->lookup_array_element(&node);
-  type_stack.push(decl ? decl->type : ValueType::NONE);
+  if (work.stage() == 0) {
+    auto decl = symbol_table->lookup_array_element(&node);
+    node.decl = decl;
+    work.defer(node, 1, {node.index_expr});
+    return;
+  }
 
-  node.index_expr->accept(*this);
-  ValueType index_type = get_top_type();
+  node.expr_type = node.decl ? node.decl->type : ValueType::NONE;
+  ValueType index_type = node.index_expr->expr_type;
   if (index_type != ValueType::INT && index_type != ValueType::NONE) {
     log_error(10, node.location,
               "Invalid index for array, expected `int` expression, got `%s`",
@@ -298,10 +358,11 @@ void SemanticAnalyzer::visit(ArrayLocationAST &node) {
 }
 void SemanticAnalyzer::visit(ArrayAddressAST &node) {
   auto decl = symbol_table->lookup_array_element(&node);
+  node.decl = decl;
   if (decl && decl->type == ValueType::INT) {
-    type_stack.push(ValueType::INT_ARRAY);
+    node.expr_type = ValueType::INT_ARRAY;
   } else {
-    type_stack.push(ValueType::NONE);
+    node.expr_type = ValueType::NONE;
   }
 }
 
@@ -313,11 +374,19 @@ void SemanticAnalyzer::visit(BinaryOperatorAST &node) {
   throw invalid_call_error(__PRETTY_FUNCTION__);
 }
 void SemanticAnalyzer::visit(ArithBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
   bool has_error = false;
 
-  for (auto val : {node.lval, node.rval}) {
-    val->accept(*this);
-    ValueType res = get_top_type();
+  ValueType ltype = node.lval->expr_type;
+  ValueType rtype = node.rval->expr_type;
+  for (auto operand : {std::make_pair(node.lval, ltype),
+                       std::make_pair(node.rval, rtype)}) {
+    BaseAST *val = operand.first;
+    ValueType res = operand.second;
     if (res != ValueType::INT) {
       has_error = true;
       if (res == ValueType::NONE)
@@ -329,14 +398,22 @@ void SemanticAnalyzer::visit(ArithBinOperatorAST &node) {
     }
   }
 
-  type_stack.push(has_error ? ValueType::NONE : ValueType::INT);
+  node.expr_type = has_error ? ValueType::NONE : ValueType::INT;
 }
 void SemanticAnalyzer::visit(CondBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
   bool has_error = false;
 
-  for (auto val : {node.lval, node.rval}) {
-    val->accept(*this);
-    ValueType res = get_top_type();
+  ValueType ltype = node.lval->expr_type;
+  ValueType rtype = node.rval->expr_type;
+  for (auto operand : {std::make_pair(node.lval, ltype),
+                       std::make_pair(node.rval, rtype)}) {
+    BaseAST *val = operand.first;
+    ValueType res = operand.second;
     if (res != ValueType::BOOL) {
       has_error = true;
       if (res == ValueType::NONE)
@@ -348,14 +425,22 @@ void SemanticAnalyzer::visit(CondBinOperatorAST &node) {
     }
   }
 
-  type_stack.push(has_error ? ValueType::NONE : ValueType::BOOL);
+  node.expr_type = has_error ? ValueType::NONE : ValueType::BOOL;
 }
 void SemanticAnalyzer::visit(RelBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
   bool has_error = false;
 
-  for (auto val : {node.lval, node.rval}) {
-    val->accept(*this);
-    ValueType res = get_top_type();
+  ValueType ltype = node.lval->expr_type;
+  ValueType rtype = node.rval->expr_type;
+  for (auto operand : {std::make_pair(node.lval, ltype),
+                       std::make_pair(node.rval, rtype)}) {
+    BaseAST *val = operand.first;
+    ValueType res = operand.second;
     if (res != ValueType::INT) {
       has_error = true;
       if (res == ValueType::NONE)
@@ -367,15 +452,18 @@ void SemanticAnalyzer::visit(RelBinOperatorAST &node) {
     }
   }
 
-  type_stack.push(has_error ? ValueType::NONE : ValueType::BOOL);
+  node.expr_type = has_error ? ValueType::NONE : ValueType::BOOL;
 }
 void SemanticAnalyzer::visit(EqBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+
   bool has_error = false;
 
-  node.lval->accept(*this);
-  ValueType ltype = get_top_type();
-  node.rval->accept(*this);
-  ValueType rtype = get_top_type();
+  ValueType ltype = node.lval->expr_type;
+  ValueType rtype = node.rval->expr_type;
 
   if (ltype != rtype) {
     if (ltype != ValueType::NONE && rtype != ValueType::NONE) {
@@ -389,12 +477,16 @@ void SemanticAnalyzer::visit(EqBinOperatorAST &node) {
     has_error = true;
   }
 
-  type_stack.push(has_error ? ValueType::NONE : ValueType::BOOL);
+  node.expr_type = has_error ? ValueType::NONE : ValueType::BOOL;
 }
 
 void SemanticAnalyzer::visit(UnaryMinusAST &node) {
-  node.val->accept(*this);
-  ValueType res = get_top_type();
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.val});
+    return;
+  }
+
+  ValueType res = node.val->expr_type;
   if (res != ValueType::INT && res != ValueType::NONE) {
     log_error(12, node.val->location,
               "Invalid operand for `%s`: Expected `int`, got `%s`",
@@ -402,11 +494,15 @@ void SemanticAnalyzer::visit(UnaryMinusAST &node) {
               value_type_to_string(res).c_str());
   }
 
-  type_stack.push(res);
+  node.expr_type = res;
 }
 void SemanticAnalyzer::visit(UnaryNotAST &node) {
-  node.val->accept(*this);
-  ValueType res = get_top_type();
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.val});
+    return;
+  }
+
+  ValueType res = node.val->expr_type;
   if (res != ValueType::BOOL && res != ValueType::NONE) {
     log_error(14, node.val->location,
               "Invalid operand for `%s`: Expected `boolean`, got `%s`",
@@ -414,11 +510,14 @@ void SemanticAnalyzer::visit(UnaryNotAST &node) {
               value_type_to_string(res).c_str());
   }
 
-  type_stack.push(res);
+  node.expr_type = res;
 }
 
 // statements.hh
 void SemanticAnalyzer::visit(ReturnStatementAST &node) {
+  if (parallel_depth > 0) {
+    log_error(19, node.location, "Unexpected return in parallel for");
+  }
   if (current_method->return_type == ValueType::VOID &&
       node.ret_expr != nullptr) {
     log_error(7, node.location, "Unexpected return expression for method `%s`",
@@ -428,8 +527,7 @@ void SemanticAnalyzer::visit(ReturnStatementAST &node) {
   if (current_method->return_type != ValueType::VOID) {
     ValueType ret_type = ValueType::VOID;
     if (node.ret_expr != nullptr) {
-      node.ret_expr->accept(*this);
-      ret_type = get_top_type();
+      ret_type = get_type(*node.ret_expr);
     }
 
     if (ret_type == ValueType::NONE)
@@ -447,6 +545,8 @@ void SemanticAnalyzer::visit(ReturnStatementAST &node) {
 void SemanticAnalyzer::visit(BreakStatementAST &node) {
   if (for_loop_depth == 0) {
     log_error(18, node.location, "Unexpected break");
+  } else if (for_loop_depth == parallel_depth) {
+    log_error(19, node.location, "Unexpected break in parallel for");
   }
 }
 void SemanticAnalyzer::visit(ContinueStatementAST &node) {
@@ -455,8 +555,7 @@ void SemanticAnalyzer::visit(ContinueStatementAST &node) {
   }
 }
 void SemanticAnalyzer::visit(IfStatementAST &node) {
-  node.cond_expr->accept(*this);
-  ValueType cond_type = get_top_type();
+  ValueType cond_type = get_type(*node.cond_expr);
   if (cond_type != ValueType::BOOL && cond_type != ValueType::NONE) {
     log_error(11, node.location,
               "Expected boolean expression for `if` condition, got `%s`",
@@ -470,8 +569,7 @@ void SemanticAnalyzer::visit(IfStatementAST &node) {
 }
 void SemanticAnalyzer::visit(ForStatementAST &node) {
   for (auto expr : {node.start_expr, node.end_expr}) {
-    expr->accept(*this);
-    ValueType type = get_top_type();
+    ValueType type = get_type(*expr);
     if (type != ValueType::INT && type != ValueType::NONE) {
       log_error(17, expr->location,
                 "Invalid loop bound expression: Expected `int`, got `%s`",
@@ -480,21 +578,88 @@ void SemanticAnalyzer::visit(ForStatementAST &node) {
   }
 
   for_loop_depth++;
+  int outer_depth = parallel_depth, outer_first_slot = parallel_first_slot;
+  std::set<VariableDeclarationAST *> outer_reads, outer_updates;
+  if (node.parallel) {
+    parallel_depth = for_loop_depth;
+    parallel_first_slot = current_method->num_locals;
+    std::swap(parallel_reads, outer_reads);
+    std::swap(parallel_updates, outer_updates);
+  }
   symbol_table->block_start();
-  auto iter = new VariableDeclarationAST(node.iterator_id, ValueType::INT);
-  symbol_table->add_variable(iter);
+  add_local(node.iterator);
 
   node.block->accept(*this);
 
   symbol_table->block_end();
-  delete iter;
   for_loop_depth--;
+
+  if (node.parallel) {
+    if (node.iterator->assign_count > 0) {
+      log_error(19, node.location,
+                "Assignment to the iterator of parallel for `%s`",
+                node.iterator_id.c_str());
+    }
+    // (each iteration would add to its own copy, and read that)
+    for (auto decl : parallel_updates) {
+      if (parallel_reads.count(decl)) {
+        log_error(19, node.location,
+                  "Variable `%s` is both read and added to in parallel for",
+                  decl->id.c_str());
+      }
+    }
+    // the outer locals are copied to the iterations, the ones added to are
+    // summed (in declaration order)
+    node.captures.assign(parallel_reads.begin(), parallel_reads.end());
+    node.reductions.assign(parallel_updates.begin(), parallel_updates.end());
+    for (auto vars : {&node.captures, &node.reductions}) {
+      std::sort(vars->begin(), vars->end(),
+                [](VariableDeclarationAST *a, VariableDeclarationAST *b) {
+                  return a->slot < b->slot;
+                });
+    }
+
+    // (the enclosing parallel for reads/adds to them as well)
+    for (auto decl : parallel_reads) {
+      if (decl->slot < outer_first_slot) {
+        outer_reads.insert(decl);
+      }
+    }
+    for (auto decl : parallel_updates) {
+      if (decl->slot < outer_first_slot) {
+        outer_updates.insert(decl);
+      }
+    }
+    parallel_depth = outer_depth;
+    parallel_first_slot = outer_first_slot;
+    std::swap(parallel_reads, outer_reads);
+    std::swap(parallel_updates, outer_updates);
+  }
 }
 void SemanticAnalyzer::visit(AssignStatementAST &node) {
-  node.lloc->accept(*this);
-  ValueType ltype = get_top_type();
-  node.rval->accept(*this);
-  ValueType rtype = get_top_type();
+  ValueType ltype = get_type(*node.lloc);
+  ValueType rtype = get_type(*node.rval);
+  if (node.lloc->decl) {
+    node.lloc->decl->assign_count++;
+  }
+
+  auto decl = node.lloc->decl;
+  if (parallel_depth > 0 && decl && node.lloc->index_expr == nullptr) {
+    if (decl->is_global) {
+      log_warning(node.location,
+                  "Write to global `%s` in parallel for (iterations race)",
+                  decl->id.c_str());
+    } else if (decl->slot < parallel_first_slot) {
+      if (node.op == OperatorType::ASSIGN) {
+        log_error(19, node.location,
+                  "Assignment to `%s`, declared outside parallel for "
+                  "(only += / -= are allowed)",
+                  decl->id.c_str());
+      } else {
+        parallel_updates.insert(decl);
+      }
+    }
+  }
 
   if (ltype == ValueType::NONE || rtype == ValueType::NONE)
     return;
@@ -531,10 +696,10 @@ void SemanticAnalyzer::visit(StatementBlockAST &node) {
   symbol_table->block_start();
 
   for (auto decl : node.variable_declarations) {
-    symbol_table->add_variable(decl);
+    add_local(decl);
   }
   for (auto statement : node.statements) {
-    statement->accept(*this);
+    work.run(*statement, *this);
   }
 
   symbol_table->block_end();
@@ -543,51 +708,63 @@ void SemanticAnalyzer::visit(StatementBlockAST &node) {
 // methods.hh
 void SemanticAnalyzer::visit(MethodDeclarationAST &node) {
   symbol_table->block_start(); // method scope
+  node.num_locals = 0;
   for (auto param : node.parameters) {
-    symbol_table->add_variable(param);
+    add_local(param);
   }
   symbol_table->hold_depth = 1; // parameter scope == function scope
   node.body->accept(*this);
 }
 
 void SemanticAnalyzer::visit(MethodCallAST &node) {
-  auto decl = symbol_table->lookup_method(&node);
-  type_stack.push(decl ? decl->return_type : ValueType::NONE);
-
-  if (!decl)
+  if (work.stage() == 0) {
+    auto decl = symbol_table->lookup_method(&node);
+    node.decl = decl;
+    if (!decl) {
+      node.expr_type = ValueType::NONE;
+      return;
+    }
+    decl->call_count++;
+
+    // check: argument ~ parameter
+    if (decl->parameters.size() != node.arguments.size()) {
+      log_error(5, node.location,
+                "Too %s arguments to method `%s` (expected %d, got %d)",
+                (decl->parameters.size() < node.arguments.size()) ? "many"
+                                                                  : "few",
+                node.id.c_str(), (int)decl->parameters.size(),
+                (int)node.arguments.size());
+      node.expr_type = decl->return_type;
+    } else {
+      work.defer(node, 1, node.arguments);
+    }
     return;
+  }
 
-  // check: argument ~ parameter
-  if (decl->parameters.size() != node.arguments.size()) {
-    log_error(5, node.location,
-              "Too %s arguments to method `%s` (expected %d, got %d)",
-              (decl->parameters.size() < node.arguments.size()) ? "many"
-                                                                : "few",
-              node.id.c_str(), (int)decl->parameters.size(),
-              (int)node.arguments.size());
-  } else {
-    for (unsigned i = 0; i < decl->parameters.size(); i++) {
-      node.arguments[i]->accept(*this);
-      ValueType arg_type = get_top_type();
-      ValueType param_type = decl->parameters[i]->type;
-
-      if (param_type != arg_type) {
-        log_error(5, node.location,
-                  "Method call `%s(...)`: Type mismatch for parameter `%s`: "
-                  "expected %s, got %s",
-                  node.id.c_str(), decl->parameters[i]->id.c_str(),
-                  value_type_to_string(param_type).c_str(),
-                  value_type_to_string(arg_type).c_str());
-      }
+  // arguments checked
+  auto decl = node.decl;
+  for (unsigned i = 0; i < decl->parameters.size(); i++) {
+    ValueType arg_type = node.arguments[i]->expr_type;
+    ValueType param_type = decl->parameters[i]->type;
+
+    if (param_type != arg_type) {
+      log_error(5, node.location,
+                "Method call `%s(...)`: Type mismatch for parameter `%s`: "
+                "expected %s, got %s",
+                node.id.c_str(), decl->parameters[i]->id.c_str(),
+                value_type_to_string(param_type).c_str(),
+                value_type_to_string(arg_type).c_str());
     }
   }
+
+  node.expr_type = decl->return_type;
 }
 
 void SemanticAnalyzer::visit(CalloutCallAST &node) {
-  for (auto &arg : node.arguments) {
-    // array address as argument
-    // TODO: cleanup (its *way* too convoluted right now)
-    {
+  if (work.stage() == 0) {
+    for (auto &arg : node.arguments) {
+      // array address as argument
+      // TODO: cleanup (its *way* too convoluted right now)
       silent(true);
       LocationAST *loc = dynamic_cast<LocationAST *>(arg);
       if (loc != nullptr && loc->index_expr == nullptr) {
@@ -601,21 +778,57 @@ void SemanticAnalyzer::visit(CalloutCallAST &node) {
       silent(false);
     }
 
-    arg->accept(*this);
+    work.defer(node, 1, node.arguments);
+    return;
+  }
 
-    ValueType expr = get_top_type();
+  // arguments checked
+  for (unsigned i = 0; i < node.arguments.size(); i++) {
+    ValueType expr = node.arguments[i]->expr_type;
     if (expr == ValueType::NONE)
       continue;
 
     if (expr != ValueType::INT && expr != ValueType::BOOL &&
         expr != ValueType::STRING && expr != ValueType::INT_ARRAY) {
-      log_error(5, arg->location, "Invalid callout argument type `%s`",
+      log_error(5, node.arguments[i]->location,
+                "Invalid callout argument type `%s`",
                 value_type_to_string(expr).c_str());
     }
 
     node.arg_types.push_back(expr);
   }
-  type_stack.push(ValueType::INT);
+  node.expr_type = ValueType::INT;
+
+  if (node.arg_types.size() != node.arguments.size())
+    return; // (invalid arguments, already reported)
+
+  // `int, boolean, ...`
+  auto to_string = [](const std::vector<ValueType> &types) {
+    std::string str;
+    for (auto type : types) {
+      str += (str.empty() ? "" : ", ") + value_type_to_string(type);
+    }
+    return str;
+  };
+
+  // arguments checked against the builtin's signature, or the first call
+  auto builtin = find_builtin(node.id);
+  if (builtin != nullptr) {
+    if (node.arg_types != builtin->params) {
+      log_error(5, node.location, "Callout `%s` takes (%s), got (%s)",
+                node.id.c_str(), to_string(builtin->params).c_str(),
+                to_string(node.arg_types).c_str());
+    }
+    return;
+  }
+  auto first = callout_signatures.emplace(
+      node.id, std::make_pair(node.arg_types, node.location));
+  if (node.arg_types != first.first->second.first) {
+    log_error(5, node.location, "Callout `%s` got (%s), but (%s) at %s",
+              node.id.c_str(), to_string(node.arg_types).c_str(),
+              to_string(first.first->second.first).c_str(),
+              first.first->second.second.c_str());
+  }
 }
 
 // program.hh
@@ -623,8 +836,13 @@ void SemanticAnalyzer::visit(ProgramAST &node) {
   symbol_table->block_start(); // global scope
 
   for_loop_depth = 0;
+  parallel_depth = parallel_first_slot = 0;
 
+  int global_slot = 0;
   for (auto decl : node.global_variables) {
+    decl->is_global = true;
+    decl->slot = global_slot++;
+
     auto adecl = dynamic_cast<ArrayDeclarationAST *>(decl);
     if (adecl == nullptr) {
       symbol_table->add_variable(decl);
@@ -633,17 +851,19 @@ void SemanticAnalyzer::visit(ProgramAST &node) {
     }
   }
 
+  int method_slot = 0;
   for (auto method : node.methods) {
+    method->slot = method_slot++;
     symbol_table->add_method(method);
     current_method = method;
     method->accept(*this);
   }
 
   // check for main:
-  if (!symbol_table->methods.count("main")) {
+  auto main = symbol_table->find_method("main");
+  if (main == nullptr) {
     log_error(3, "", "Method `main` not declared!");
   } else {
-    auto main = symbol_table->methods["main"];
     if (main->return_type != ValueType::VOID) {
       log_error(3, main->location,
                 "Method `main` must return void (instead returns `%s`)",
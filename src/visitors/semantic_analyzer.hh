@@ -1,12 +1,14 @@
 #pragma once
 
+#include <deque>
 #include <map>
 #include <ostream>
-#include <stack>
+#include <set>
 #include <string>
 #include <vector>
 
 #include "visitor.hh"
+#include "work_stack.hh"
 
 class SemanticAnalyzer : public ASTvisitor {
 public:
@@ -17,15 +19,17 @@ public:
   void display(std::ostream &out, const bool show_rules = false);
 
 protected:
+  // Flat symbol table: every name is interned once in an open-addressing
+  // hash table, and points to its innermost binding. Bindings live on a
+  // single stack (which doubles as the undo log for block_end), and each one
+  // links to the binding it shadows, so lookups don't depend on the depth.
   class SymbolTable {
   public:
     SymbolTable(SemanticAnalyzer &_analyzer)
-        : analyzer(_analyzer), variables(0), methods(), scope_depth(0),
-          hold_depth(0) {}
+        : scope_depth(0), hold_depth(0), analyzer(_analyzer),
+          table(INITIAL_CAPACITY, nullptr) {}
     ~SymbolTable() = default;
 
-    SemanticAnalyzer &analyzer;
-
     // enter a new block, add an inner-most scope layer
     void block_start();
     // remove the inner-most scope layer
@@ -41,27 +45,76 @@ protected:
     VariableDeclarationAST *lookup_variable(LocationAST *varloc);
     ArrayDeclarationAST *lookup_array_element(LocationAST *arrloc);
     MethodDeclarationAST *lookup_method(MethodCallAST *mcall);
+    // method declared as `name`, if any (no errors logged)
+    MethodDeclarationAST *find_method(const std::string &name);
 
-    std::vector<std::map<std::string, VariableDeclarationAST *>> variables;
-    std::map<std::string, ArrayDeclarationAST *> arrays;
-    std::map<std::string, MethodDeclarationAST *> methods;
     int scope_depth, hold_depth;
+
+  private:
+    SemanticAnalyzer &analyzer;
+
+    enum class SymbolKind { VARIABLE, ARRAY, METHOD };
+    struct Symbol {
+      std::string name;
+      int binding; // index of the innermost binding, -1 if none
+    };
+    struct Binding {
+      Symbol *symbol;
+      SymbolKind kind;
+      BaseAST *decl;
+      int depth;
+      int shadowed; // index of the binding this one hides, -1 if none
+    };
+
+    // returns the interned symbol for `name` (nullptr if `create` is not set
+    // and the name was never declared)
+    Symbol *intern(const std::string &name, bool create = true);
+    void rehash();
+    Binding *innermost(const std::string &name);
+    void bind(Symbol *symbol, SymbolKind kind, BaseAST *decl);
+
+    static const int INITIAL_CAPACITY = 64;
+    std::vector<Symbol *> table;
+    std::deque<Symbol> symbols;
+
+    std::vector<Binding> bindings;
+    std::vector<int> scope_marks; // bindings.size() at each block_start
   };
 
   bool _silent;
   void silent(bool f);
   void log_error(const int error_type, const std::string &location,
                  const std::string &fmt, ...);
+  // (reported, but the program is still compiled)
+  void log_warning(const std::string &location, const std::string &fmt, ...);
 
 private:
   SymbolTable *symbol_table;
   int for_loop_depth;
   MethodDeclarationAST *current_method;
 
-  std::stack<ValueType> type_stack;
-  ValueType get_top_type(bool pop = true);
+  // innermost enclosing `parallel for`: its for_loop_depth, and the first
+  // slot of the locals declared in it (both 0 if none)
+  int parallel_depth, parallel_first_slot;
+  // locals declared outside it, read/added to in its body
+  std::set<VariableDeclarationAST *> parallel_reads, parallel_updates;
+
+  // argument types of the first call to each callout that isn't a builtin
+  // (calls must agree: each callout gets a single prototype), and its
+  // location
+  std::map<std::string, std::pair<std::vector<ValueType>, std::string>>
+      callout_signatures;
+
+  // add a parameter/local variable of the current method, assigning its slot
+  void add_local(VariableDeclarationAST *decl);
+
+  // check an expression (iteratively), and return its type
+  ValueType get_type(BaseAST &expr);
+
+  WorkStack work;
 
   std::vector<std::pair<int, std::string>> errors;
+  std::vector<std::string> warnings;
   const static int BUFFER_LENGTH = 100;
   char _buffer[BUFFER_LENGTH];
 
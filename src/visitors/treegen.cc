@@ -145,7 +145,7 @@ void TreeGenerator::visit(IfStatementAST &node) {
   stack.push(id);
 }
 void TreeGenerator::visit(ForStatementAST &node) {
-  int id = add_node("for");
+  int id = add_node(node.parallel ? "parallel for" : "for");
 
   add_edge_implicit(id, node.iterator_id);
   node.start_expr->accept(*this);
@@ -0,0 +1,171 @@
+#include "../ast/ast.hh"
+#include "../ast/blocks.hh"
+#include "../ast/literals.hh"
+#include "../ast/methods.hh"
+#include "../ast/operators.hh"
+#include "../ast/program.hh"
+#include "../ast/statements.hh"
+#include "../ast/variables.hh"
+#include "../exceptions.hh"
+#include "type_verifier.hh"
+
+bool TypeVerifier::verify(BaseAST &root) {
+  root.accept(*this);
+  return untyped.empty();
+}
+
+void TypeVerifier::display(std::ostream &out) {
+  for (auto &location : untyped) {
+    out << "Error: expression without a type at " << location << "\n";
+  }
+  if (!untyped.empty()) {
+    out << "type verification: " << untyped.size() << " of " << expressions
+        << " expressions without a type\n";
+  }
+}
+
+void TypeVerifier::check(BaseAST &expr) {
+  expressions++;
+  if (expr.expr_type == ValueType::NONE) {
+    untyped.push_back(expr.location);
+  }
+}
+
+// Visit functions
+void TypeVerifier::visit(BaseAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+
+// literals.hh
+void TypeVerifier::visit(LiteralAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+void TypeVerifier::visit(IntegerLiteralAST &node) { check(node); }
+void TypeVerifier::visit(BooleanLiteralAST &node) { check(node); }
+void TypeVerifier::visit(StringLiteralAST &node) { check(node); }
+
+// variables.hh
+void TypeVerifier::visit(LocationAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+void TypeVerifier::visit(VariableLocationAST &node) { check(node); }
+void TypeVerifier::visit(ArrayLocationAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.index_expr});
+    return;
+  }
+  check(node);
+}
+void TypeVerifier::visit(ArrayAddressAST &node) { check(node); }
+
+// operators.hh
+void TypeVerifier::visit(UnaryOperatorAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+void TypeVerifier::visit(BinaryOperatorAST &node) {
+  throw invalid_call_error(__PRETTY_FUNCTION__);
+}
+
+void TypeVerifier::visit(ArithBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+  check(node);
+}
+void TypeVerifier::visit(CondBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+  check(node);
+}
+void TypeVerifier::visit(RelBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+  check(node);
+}
+void TypeVerifier::visit(EqBinOperatorAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.lval, node.rval});
+    return;
+  }
+  check(node);
+}
+void TypeVerifier::visit(UnaryMinusAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.val});
+    return;
+  }
+  check(node);
+}
+void TypeVerifier::visit(UnaryNotAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, {node.val});
+    return;
+  }
+  check(node);
+}
+
+// statements.hh
+void TypeVerifier::visit(ReturnStatementAST &node) {
+  if (node.ret_expr) {
+    work.run(*node.ret_expr, *this);
+  }
+}
+
+void TypeVerifier::visit(IfStatementAST &node) {
+  work.run(*node.cond_expr, *this);
+  node.then_block->accept(*this);
+  if (node.else_block) {
+    node.else_block->accept(*this);
+  }
+}
+
+void TypeVerifier::visit(ForStatementAST &node) {
+  work.run(*node.start_expr, *this);
+  work.run(*node.end_expr, *this);
+  node.block->accept(*this);
+}
+
+void TypeVerifier::visit(AssignStatementAST &node) {
+  work.run(*node.lloc, *this);
+  work.run(*node.rval, *this);
+}
+
+// blocks.hh
+void TypeVerifier::visit(StatementBlockAST &node) {
+  for (auto statement : node.statements) {
+    work.run(*statement, *this);
+  }
+}
+
+// methods.hh
+void TypeVerifier::visit(MethodDeclarationAST &node) {
+  node.body->accept(*this);
+}
+
+// (calls of void methods have type VOID)
+void TypeVerifier::visit(MethodCallAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, node.arguments);
+    return;
+  }
+  check(node);
+}
+void TypeVerifier::visit(CalloutCallAST &node) {
+  if (work.stage() == 0) {
+    work.defer(node, 1, node.arguments);
+    return;
+  }
+  check(node);
+}
+
+// program.hh
+void TypeVerifier::visit(ProgramAST &node) {
+  for (auto method : node.methods) {
+    method->accept(*this);
+  }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "visitor.hh"
+#include "work_stack.hh"
+
+// Checks that every expression of a checked AST has a type
+// (BaseAST::expr_type is not NONE), as code generation relies on it: catches
+// expressions that semantic analysis, or an AST optimization creating nodes,
+// missed. Run with `--check-types` (by `make test`), before code generation.
+class TypeVerifier : public ASTvisitor {
+public:
+  TypeVerifier() : expressions(0) {}
+  virtual ~TypeVerifier() = default;
+
+  // whether every expression has a type
+  bool verify(BaseAST &root);
+  void display(std::ostream &out);
+
+private:
+  WorkStack work;
+  // locations of the expressions without a type
+  std::vector<std::string> untyped;
+  long expressions;
+
+  void check(BaseAST &expr);
+
+public:
+  // visits:
+  virtual void visit(BaseAST &node);
+
+  // literals.hh
+  virtual void visit(LiteralAST &node);
+  virtual void visit(IntegerLiteralAST &node);
+  virtual void visit(BooleanLiteralAST &node);
+  virtual void visit(StringLiteralAST &node);
+
+  // variables.hh
+  virtual void visit(LocationAST &node);
+  virtual void visit(VariableLocationAST &node);
+  virtual void visit(ArrayLocationAST &node);
+  virtual void visit(ArrayAddressAST &node);
+  virtual void visit(VariableDeclarationAST &node) {}
+  virtual void visit(ArrayDeclarationAST &node) {}
+
+  // operators.hh
+  virtual void visit(UnaryOperatorAST &node);
+  virtual void visit(BinaryOperatorAST &node);
+  virtual void visit(ArithBinOperatorAST &node);
+  virtual void visit(CondBinOperatorAST &node);
+  virtual void visit(RelBinOperatorAST &node);
+  virtual void visit(EqBinOperatorAST &node);
+  virtual void visit(UnaryMinusAST &node);
+  virtual void visit(UnaryNotAST &node);
+
+  // statements.hh
+  virtual void visit(ReturnStatementAST &node);
+  virtual void visit(BreakStatementAST &node) {}
+  virtual void visit(ContinueStatementAST &node) {}
+  virtual void visit(IfStatementAST &node);
+  virtual void visit(ForStatementAST &node);
+  virtual void visit(AssignStatementAST &node);
+
+  // blocks.hh
+  virtual void visit(StatementBlockAST &node);
+
+  // methods.hh
+  virtual void visit(MethodDeclarationAST &node);
+  virtual void visit(MethodCallAST &node);
+  virtual void visit(CalloutCallAST &node);
+
+  // program.hh
+  virtual void visit(ProgramAST &node);
+};
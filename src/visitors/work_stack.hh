@@ -0,0 +1,56 @@
+#pragma once
+
+#include <initializer_list>
+#include <stack>
+#include <utility>
+#include <vector>
+
+#include "visitor.hh"
+
+// Explicit work stack, used by visitors to walk (arbitrarily deep) expression
+// trees without recursing on the C++ stack.
+//
+// A visit that needs its operands first defers itself to a later stage and
+// schedules the operands; run() keeps popping items until everything pushed
+// on behalf of `root` is done, so the operands are visited (in order) before
+// the deferred node is visited again.
+class WorkStack {
+public:
+  WorkStack() : current_stage(0) {}
+  ~WorkStack() = default;
+
+  // visit `root`, and everything scheduled by it
+  void run(BaseAST &root, ASTvisitor &V) {
+    std::size_t base = work.size();
+    work.emplace(&root, 0);
+    while (work.size() > base) {
+      auto item = work.top();
+      work.pop();
+      current_stage = item.second;
+      item.first->accept(V);
+    }
+  }
+
+  // stage of the node currently being visited (0 on first visit)
+  int stage() const { return current_stage; }
+
+  // revisit `node` at `stage`, after visiting `operands` (in order)
+  void defer(BaseAST &node, int stage,
+             std::initializer_list<BaseAST *> operands) {
+    work.emplace(&node, stage);
+    for (auto it = operands.end(); it != operands.begin();) {
+      work.emplace(*--it, 0);
+    }
+  }
+  void defer(BaseAST &node, int stage,
+             const std::vector<BaseAST *> &operands) {
+    work.emplace(&node, stage);
+    for (auto it = operands.rbegin(); it != operands.rend(); it++) {
+      work.emplace(*it, 0);
+    }
+  }
+
+private:
+  std::stack<std::pair<BaseAST *, int>> work;
+  int current_stage;
+};
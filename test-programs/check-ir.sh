@@ -0,0 +1,70 @@
+#! env bash
+
+# Checks the shape of generated LLVM IR (see `make test` and `make stress`):
+# no empty basic blocks, no instructions after a block's terminator, and the
+# number of blocks and instructions of each file as recorded in `counts`
+# (lines of `<name> <blocks> <instructions>`, name without .ll)
+
+# @arg $1 : counts file, or --print to print the counts of the files instead
+# @arg $2... : .ll files
+
+if [[ "$#" -lt 2 ]] ; then
+	echo "Usage: test-programs/check-ir.sh <counts>|--print <file.ll>..."
+	exit 1
+fi
+counts=$1
+shift
+
+status=0
+for ll in "$@" ; do
+	name=$(basename ${ll%.ll})
+	# prints `<blocks> <instructions>`, and errors to stderr
+	shape=$(awk -v file=$ll '
+		function fail(message) {
+			print file ":" NR ": " message > "/dev/stderr"
+			failed = 1
+		}
+		function end_block() {
+			if (size == 0) fail("empty block " label)
+		}
+		/^define / {
+			body = 1; entry = 1
+			blocks++; size = 0; ended = 0; label = "entry"
+			next
+		}
+		!body { next }
+		/^}/ { end_block(); body = 0; next }
+		/^[^ ;][^ ]*:/ {
+			# (the label of the entry block, if it is named)
+			if (!entry || size > 0) {
+				end_block()
+				blocks++; size = 0; ended = 0
+			}
+			entry = 0
+			label = $1
+			next
+		}
+		# (instructions; deeper lines continue them, eg. switch cases)
+		/^  [^ ;\]]/ {
+			if (ended) fail("instruction after the terminator of " label)
+			instructions++; size++
+			op = $1
+			if ($2 == "=") op = $3
+			ended = op ~ /^(ret|br|switch|indirectbr|invoke|callbr|resume|unreachable)$/
+		}
+		END {
+			print blocks + 0, instructions + 0
+			exit failed
+		}' $ll) || status=1
+
+	if [[ "$counts" == "--print" ]] ; then
+		echo "$name $shape"
+		continue
+	fi
+	expected=$(awk -v name=$name '$1 == name { print $2, $3 }' $counts)
+	if [[ "$shape" != "$expected" ]] ; then
+		echo "$ll: expected ${expected:-no counts} (blocks instructions), got $shape"
+		status=1
+	fi
+done
+exit $status
@@ -0,0 +1,44 @@
+#! env bash
+
+# Generates pathologically deep/long Decaf programs, to check that the
+# compiler handles them without running out of stack (see `make stress`)
+
+# @arg $1 : directory to write the programs to
+
+if [[ "$#" -lt 1 ]] ; then
+	echo "Usage: test-programs/stress/generate.sh <output-dir>"
+	exit 1
+fi
+out=$1
+mkdir -p $out
+
+# `text` repeated n times
+repeat() {
+	yes "$1" | head -n $2 | tr -d '\n'
+}
+
+# program whose main declares int x, runs `body`, and prints x
+program() {
+	echo "class Program {"
+	echo "	void main() {"
+	echo "		int x;"
+	echo "$1"
+	echo "		callout(\"write_int\", x);"
+	echo "	}"
+	echo "}"
+}
+
+# 10^6 terms: 1 + 1 + ... + 1 (prints 1000000)
+program "		x = $(repeat '1 + ' 999999)1;" > $out/expr.dcf
+
+# 10^5 nested parentheses: ((...(1)+1)...)+1 (prints 100001)
+program "		x = $(repeat '(' 100000)1$(repeat ')+1' 100000);" > $out/paren.dcf
+
+# 10^5 unary minuses: --...-1 (prints 1)
+program "		x = $(repeat '-' 100000)1;" > $out/minus.dcf
+
+# 2*10^5 statements: x += 1; ... (prints 200000)
+program "$(yes '		x += 1;' | head -n 200000)" > $out/stmts.dcf
+
+# 10^5 callout arguments (to an external function, so only compiled)
+program "		x = callout(\"sum\"$(repeat ', 1' 100000));" > $out/args.dcf